@@ -63,6 +63,15 @@ extern "C" {
 #define DETACH_KERNEL_DRIVER
 #endif
 
+/* Hotplug notification appeared in libusb 1.0.16, and
+   libusb_interrupt_event_handler() in libusb 1.0.21. */
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+#define HAVE_LIBUSB_HOTPLUG
+#endif
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+#define HAVE_LIBUSB_INTERRUPT_EVENT_HANDLER
+#endif
+
 /* Uncomment to enable the retrieval of Usage and Usage Page in
 hid_enumerate(). Warning, on platforms different from FreeBSD
 this is very invasive as it requires the detach
@@ -72,11 +81,8 @@ instead to differentiate between interfaces on a composite HID device. */
 /*#define INVASIVE_GET_USAGE*/
 
 /* Linked List of input reports received from the device. */
-struct input_report {
-	uint8_t *data;
-	size_t len;
-	struct input_report *next;
-};
+/* Number of input report slots per device (a power of 2). */
+#define INPUT_RING_SLOTS 32
 
 
 struct hid_device_ {
@@ -99,31 +105,87 @@ struct hid_device_ {
 	/* Whether blocking reads are used */
 	int blocking; /* boolean */
 
-	/* Read thread objects */
-	pthread_t thread;
-	pthread_mutex_t mutex; /* Protects input_reports */
+	/* Whether reads are performed on the caller's thread (no input
+	   transfer is submitted), and the buffer used for them. */
+	int direct_read; /* boolean */
+	unsigned char *direct_buffer;
+
+	/* Input transfer objects. The transfer is serviced by the shared
+	   event_thread(). */
+	pthread_mutex_t mutex; /* Protects transfer state, serializes readers */
 	pthread_cond_t condition;
-	pthread_barrier_t barrier; /* Ensures correct startup sequence */
-	int shutdown_thread;
+	/* Stop (or stopped) resubmitting. Only set under the mutex, but
+	   read_callback() reads it atomically without the mutex. */
+	int shutdown_transfer;
+	int transfer_active; /* Submitted; cleared by read_callback() */
 	struct libusb_transfer *transfer;
 
-	/* List of received input reports. */
-	struct input_report *input_reports;
+	/* Ring of received input reports. read_callback() is the only
+	   producer (it advances ring_head) and readers holding the mutex
+	   are the only consumer (they advance ring_tail), so no lock is
+	   needed to pass reports. Slots are input_ep_max_packet_size bytes
+	   and share the transfer buffer allocation. */
+	unsigned char *ring_data;
+	size_t ring_len[INPUT_RING_SLOTS];
+	unsigned int ring_head;
+	unsigned int ring_tail;
+	unsigned long ring_overflow; /* Reports dropped with the ring full */
+	int ring_waiters; /* Readers waiting on condition */
 };
 
 static libusb_context *usb_context = NULL;
 
+/* A single event_thread() handles all libusb events on usb_context: it
+   services the input transfers of every open device and delivers hotplug
+   callbacks. */
+static int event_shutdown = 0;
+static pthread_t event_thread_id;
+
+/* Hotplug state. The generation is bumped by hotplug_callback() (called
+   from event_thread()) and is -1 while hotplug is not available. */
+static pthread_mutex_t hotplug_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int hotplug_generation = -1;
+#ifdef HAVE_LIBUSB_HOTPLUG
+static libusb_hotplug_callback_handle hotplug_handle;
+#endif
+
+/* Index of attached devices, keyed by (bus << 8) | address (the first two
+   components of a path), so that hid_open_path() only has to query the
+   device it opens. Rebuilt when the hotplug generation changes. */
+struct device_index_entry {
+	int key;
+	libusb_device *dev; /* referenced, or NULL if the slot is unused */
+};
+/* Multiplicative hash, folded so that the low bits (used for the slot)
+   depend on every bit of the key, bus number included. */
+static size_t index_hash(int key)
+{
+	unsigned int h = (unsigned int) key * 2654435761u;
+	return h ^ (h >> 16);
+}
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct device_index_entry *device_index = NULL;
+static size_t device_index_size = 0; /* power of 2 */
+static int device_index_valid = 0;
+static int device_index_generation = -1;
+
 uint16_t get_usb_code_for_current_locale(void);
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
+static void index_release(void);
 
 static hid_device *new_hid_device(void)
 {
 	hid_device *dev = calloc(1, sizeof(hid_device));
-	dev->blocking = 1;
+	pthread_condattr_t attr;
 
+	dev->blocking = 1;
 	pthread_mutex_init(&dev->mutex, NULL);
-	pthread_cond_init(&dev->condition, NULL);
-	pthread_barrier_init(&dev->barrier, NULL, 2);
+
+	/* Measure read timeouts on the monotonic clock, so they are not
+	   affected by changes to the system time. */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dev->condition, &attr);
+	pthread_condattr_destroy(&attr);
 
 	return dev;
 }
@@ -131,7 +193,6 @@ static hid_device *new_hid_device(void)
 static void free_hid_device(hid_device *dev)
 {
 	/* Clean up the thread objects */
-	pthread_barrier_destroy(&dev->barrier);
 	pthread_cond_destroy(&dev->condition);
 	pthread_mutex_destroy(&dev->mutex);
 
@@ -403,6 +464,102 @@ static char *make_path(libusb_device *dev, int interface_number)
 }
 
 
+#ifdef HAVE_LIBUSB_HOTPLUG
+static int LIBUSB_CALL hotplug_callback(libusb_context *ctx, libusb_device *device,
+	libusb_hotplug_event event, void *user_data)
+{
+	(void) ctx;
+	(void) device;
+	(void) event;
+	(void) user_data;
+
+	pthread_mutex_lock(&hotplug_mutex);
+	hotplug_generation = (hotplug_generation + 1) & 0x7fffffff;
+	pthread_mutex_unlock(&hotplug_mutex);
+
+	/* Keep this callback registered. */
+	return 0;
+}
+
+#endif /* HAVE_LIBUSB_HOTPLUG */
+
+static void *event_thread(void *param)
+{
+	(void) param;
+
+	/* Transfer and hotplug callbacks are called from here. */
+	while (!event_shutdown) {
+		int res;
+#ifdef HAVE_LIBUSB_INTERRUPT_EVENT_HANDLER
+		res = libusb_handle_events_completed(usb_context, &event_shutdown);
+#else
+		/* Without libusb_interrupt_event_handler(), poll for shutdown. */
+		struct timeval tv = {1, 0};
+		res = libusb_handle_events_timeout_completed(usb_context, &tv, &event_shutdown);
+#endif
+		if (res < 0) {
+			LOG("event_thread(): libusb reports error # %d\n", res);
+			if (res != LIBUSB_ERROR_BUSY &&
+			    res != LIBUSB_ERROR_TIMEOUT &&
+			    res != LIBUSB_ERROR_OVERFLOW &&
+			    res != LIBUSB_ERROR_INTERRUPTED) {
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void hotplug_start(void)
+{
+#ifdef HAVE_LIBUSB_HOTPLUG
+	int res;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		return;
+
+	res = libusb_hotplug_register_callback(usb_context,
+		LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+		LIBUSB_HOTPLUG_NO_FLAGS,
+		LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+		LIBUSB_HOTPLUG_MATCH_ANY,
+		hotplug_callback, NULL, &hotplug_handle);
+	if (res != 0) {
+		LOG("Unable to register hotplug callback: %d\n", res);
+		return;
+	}
+
+	pthread_mutex_lock(&hotplug_mutex);
+	hotplug_generation = 0;
+	pthread_mutex_unlock(&hotplug_mutex);
+#endif
+}
+
+static void hotplug_stop(void)
+{
+#ifdef HAVE_LIBUSB_HOTPLUG
+	pthread_mutex_lock(&hotplug_mutex);
+	if (hotplug_generation < 0) {
+		pthread_mutex_unlock(&hotplug_mutex);
+		return;
+	}
+	hotplug_generation = -1;
+	pthread_mutex_unlock(&hotplug_mutex);
+
+	libusb_hotplug_deregister_callback(usb_context, hotplug_handle);
+#endif
+}
+
+static void event_stop(void)
+{
+	event_shutdown = 1;
+#ifdef HAVE_LIBUSB_INTERRUPT_EVENT_HANDLER
+	libusb_interrupt_event_handler(usb_context);
+#endif
+	pthread_join(event_thread_id, NULL);
+}
+
 int HID_API_EXPORT hid_init(void)
 {
 	if (!usb_context) {
@@ -416,6 +573,18 @@ int HID_API_EXPORT hid_init(void)
 		locale = setlocale(LC_CTYPE, NULL);
 		if (!locale)
 			setlocale(LC_CTYPE, "");
+
+		/* Track device arrival/removal (if supported). */
+		hotplug_start();
+
+		/* Start handling events for all devices. */
+		event_shutdown = 0;
+		if (pthread_create(&event_thread_id, NULL, event_thread, NULL)) {
+			hotplug_stop();
+			libusb_exit(usb_context);
+			usb_context = NULL;
+			return -1;
+		}
 	}
 
 	return 0;
@@ -424,6 +593,11 @@ int HID_API_EXPORT hid_init(void)
 int HID_API_EXPORT hid_exit(void)
 {
 	if (usb_context) {
+		hotplug_stop();
+		event_stop();
+		pthread_mutex_lock(&index_mutex);
+		index_release();
+		pthread_mutex_unlock(&index_mutex);
 		libusb_exit(usb_context);
 		usb_context = NULL;
 	}
@@ -592,6 +766,20 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	return root;
 }
 
+int HID_API_EXPORT hid_hotplug_generation(void)
+{
+	int generation;
+
+	if (hid_init() < 0)
+		return -1;
+
+	pthread_mutex_lock(&hotplug_mutex);
+	generation = hotplug_generation;
+	pthread_mutex_unlock(&hotplug_mutex);
+
+	return generation;
+}
+
 void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 {
 	struct hid_device_info *d = devs;
@@ -641,53 +829,125 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const
 	return handle;
 }
 
-static void read_callback(struct libusb_transfer *transfer)
+/* Release the device index. Must be called with index_mutex locked. */
+static void index_release(void)
 {
-	hid_device *dev = transfer->user_data;
-	int res;
+	size_t i;
 
-	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+	for (i = 0; i < device_index_size; i++) {
+		if (device_index[i].dev)
+			libusb_unref_device(device_index[i].dev);
+	}
+	free(device_index);
+	device_index = NULL;
+	device_index_size = 0;
+	device_index_valid = 0;
+}
 
-		struct input_report *rpt = malloc(sizeof(*rpt));
-		rpt->data = malloc(transfer->actual_length);
-		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-		rpt->len = transfer->actual_length;
-		rpt->next = NULL;
+/* Rebuild the device index. Must be called with index_mutex locked. */
+static void index_rebuild(void)
+{
+	libusb_device **devs;
+	ssize_t num_devs;
+	size_t size, i;
 
-		pthread_mutex_lock(&dev->mutex);
+	index_release();
 
-		/* Attach the new report object to the end of the list. */
-		if (dev->input_reports == NULL) {
-			/* The list is empty. Put it at the root. */
-			dev->input_reports = rpt;
-			pthread_cond_signal(&dev->condition);
+	/* Only the device list is needed. No descriptors are fetched. */
+	num_devs = libusb_get_device_list(usb_context, &devs);
+	if (num_devs < 0)
+		return;
+
+	/* Keep the table at most half full. */
+	for (size = 16; size < 2 * (size_t) num_devs; size <<= 1)
+		;
+	device_index = calloc(size, sizeof(*device_index));
+	if (device_index) {
+		device_index_size = size;
+		for (i = 0; i < (size_t) num_devs; i++) {
+			int key = (libusb_get_bus_number(devs[i]) << 8) |
+			          libusb_get_device_address(devs[i]);
+			size_t slot = index_hash(key) & (size - 1);
+			while (device_index[slot].dev)
+				slot = (slot + 1) & (size - 1);
+			device_index[slot].key = key;
+			device_index[slot].dev = libusb_ref_device(devs[i]);
 		}
-		else {
-			/* Find the end of the list and attach. */
-			struct input_report *cur = dev->input_reports;
-			int num_queued = 0;
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
+		device_index_valid = 1;
+	}
+
+	libusb_free_device_list(devs, 1);
+}
+
+/* Look up a device by (bus << 8) | address. The index is rebuilt first if
+   it is invalid, if hotplug reports a change, or if force is set; rebuilt
+   tells the caller whether that happened. Returns a referenced device
+   (release with libusb_unref_device()) or NULL. */
+static libusb_device *find_device(int key, int force, int *rebuilt)
+{
+	libusb_device *usb_dev = NULL;
+	int generation = hid_hotplug_generation();
+
+	pthread_mutex_lock(&index_mutex);
+	*rebuilt = 0;
+	if (force || !device_index_valid ||
+	    (generation >= 0 && generation != device_index_generation)) {
+		index_rebuild();
+		device_index_generation = generation;
+		*rebuilt = 1;
+	}
+	if (device_index_size) {
+		size_t slot = index_hash(key) & (device_index_size - 1);
+		while (device_index[slot].dev) {
+			if (device_index[slot].key == key) {
+				usb_dev = libusb_ref_device(device_index[slot].dev);
+				break;
 			}
-			cur->next = rpt;
+			slot = (slot + 1) & (device_index_size - 1);
+		}
+	}
+	pthread_mutex_unlock(&index_mutex);
+
+	return usb_dev;
+}
 
-			/* Pop one off if we've reached 30 in the queue. This
-			   way we don't grow forever if the user never reads
-			   anything from the device. */
-			if (num_queued > 30) {
-				return_data(dev, NULL, 0);
+static void read_callback(struct libusb_transfer *transfer)
+{
+	hid_device *dev = transfer->user_data;
+	int stop = 0;
+	int res;
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		unsigned int head = dev->ring_head;
+		unsigned int tail = __atomic_load_n(&dev->ring_tail, __ATOMIC_ACQUIRE);
+
+		if (head - tail < INPUT_RING_SLOTS) {
+			/* Copy the report into the next free slot and publish
+			   it. */
+			size_t slot = head & (INPUT_RING_SLOTS - 1);
+			memcpy(dev->ring_data + slot * dev->input_ep_max_packet_size,
+				transfer->buffer, transfer->actual_length);
+			dev->ring_len[slot] = transfer->actual_length;
+			__atomic_store_n(&dev->ring_head, head + 1, __ATOMIC_SEQ_CST);
+
+			/* Only take the mutex if a reader is asleep. */
+			if (__atomic_load_n(&dev->ring_waiters, __ATOMIC_SEQ_CST)) {
+				pthread_mutex_lock(&dev->mutex);
+				pthread_cond_signal(&dev->condition);
+				pthread_mutex_unlock(&dev->mutex);
 			}
 		}
-		pthread_mutex_unlock(&dev->mutex);
+		else {
+			/* The user is not reading. Drop (and count) the new
+			   report rather than growing or blocking. */
+			__atomic_add_fetch(&dev->ring_overflow, 1, __ATOMIC_RELAXED);
+		}
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
-		dev->shutdown_thread = 1;
-		return;
+		stop = 1;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
-		dev->shutdown_thread = 1;
-		return;
+		stop = 1;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
 		/*LOG("Timeout (normal)\n");*/
@@ -696,24 +956,49 @@ static void read_callback(struct libusb_transfer *transfer)
 		LOG("Unknown transfer code: %d\n", transfer->status);
 	}
 
-	/* Re-submit the transfer object. */
-	res = libusb_submit_transfer(transfer);
-	if (res != 0) {
+	/* Re-submit the transfer object, unless stop_reading() has been
+	   called. Readers hold the mutex, so it is not taken here. */
+	if (!stop && !__atomic_load_n(&dev->shutdown_transfer, __ATOMIC_SEQ_CST)) {
+		res = libusb_submit_transfer(transfer);
+		if (res == 0) {
+			/* stop_reading() sets shutdown_transfer before it
+			   cancels. If it did so since the check above, its
+			   cancel may have missed the new submission: cancel on
+			   its behalf. */
+			if (__atomic_load_n(&dev->shutdown_transfer, __ATOMIC_SEQ_CST))
+				libusb_cancel_transfer(transfer);
+			return;
+		}
 		LOG("Unable to submit URB. libusb error code: %d\n", res);
-		dev->shutdown_thread = 1;
 	}
+
+	/* The transfer is no longer in flight. Wake hid_close() and any
+	   threads which are waiting on data (in hid_read_timeout()). */
+	pthread_mutex_lock(&dev->mutex);
+	__atomic_store_n(&dev->shutdown_transfer, 1, __ATOMIC_SEQ_CST);
+	dev->transfer_active = 0;
+	pthread_cond_broadcast(&dev->condition);
+	pthread_mutex_unlock(&dev->mutex);
 }
 
 
-static void *read_thread(void *param)
+/* Submit the input transfer. From then on it is serviced by
+   event_thread(). Returns 0 on success. */
+static int start_reading(hid_device *dev)
 {
-	hid_device *dev = param;
 	unsigned char *buf;
 	const size_t length = dev->input_ep_max_packet_size;
 
-	/* Set up the transfer object. */
-	buf = malloc(length);
+	/* Set up the transfer object. The report ring follows the transfer
+	   buffer. */
+	buf = malloc(length * (1 + INPUT_RING_SLOTS));
 	dev->transfer = libusb_alloc_transfer(0);
+	if (!buf || !dev->transfer) {
+		free(buf);
+		libusb_free_transfer(dev->transfer);
+		dev->transfer = NULL;
+		return -1;
+	}
 	libusb_fill_interrupt_transfer(dev->transfer,
 		dev->device_handle,
 		dev->input_endpoint,
@@ -725,54 +1010,152 @@ static void *read_thread(void *param)
 
 	/* Make the first submission. Further submissions are made
 	   from inside read_callback() */
-	libusb_submit_transfer(dev->transfer);
+	pthread_mutex_lock(&dev->mutex);
+	dev->ring_data = buf + length;
+	dev->ring_head = dev->ring_tail = 0;
+	dev->shutdown_transfer = 0;
+	dev->transfer_active = (libusb_submit_transfer(dev->transfer) == 0);
+	pthread_mutex_unlock(&dev->mutex);
 
-	/* Notify the main thread that the read thread is up and running. */
-	pthread_barrier_wait(&dev->barrier);
+	if (!dev->transfer_active) {
+		free(buf);
+		libusb_free_transfer(dev->transfer);
+		dev->transfer = NULL;
+		return -1;
+	}
+	return 0;
+}
 
-	/* Handle all the events. */
-	while (!dev->shutdown_thread) {
-		int res;
-		res = libusb_handle_events(usb_context);
-		if (res < 0) {
-			/* There was an error. */
-			LOG("read_thread(): libusb reports error # %d\n", res);
+static void stop_reading(hid_device *dev)
+{
+	/* Cause read_callback() to stop resubmitting, then wait for the
+	   transfer to complete. The cancellation will fail if the transfer
+	   already stopped (e.g. on disconnect), but that's OK. */
+	pthread_mutex_lock(&dev->mutex);
+	__atomic_store_n(&dev->shutdown_transfer, 1, __ATOMIC_SEQ_CST);
+	if (dev->transfer_active)
+		libusb_cancel_transfer(dev->transfer);
+	while (dev->transfer_active)
+		pthread_cond_wait(&dev->condition, &dev->mutex);
+
+	/* Clear out the queue of received reports. */
+	dev->ring_tail = dev->ring_head;
+	pthread_mutex_unlock(&dev->mutex);
+
+	/* Clean up the Transfer objects (and ring) allocated in
+	   start_reading(). */
+	free(dev->transfer->buffer);
+	libusb_free_transfer(dev->transfer);
+	dev->transfer = NULL;
+	dev->ring_data = NULL;
+}
+
+
+/* Claim the HID interface numbered interface_number on usb_dev and start
+   reading from it. Returns 0 on success. */
+static int open_interface(hid_device *dev, libusb_device *usb_dev, int interface_number)
+{
+	struct libusb_device_descriptor desc;
+	struct libusb_config_descriptor *conf_desc = NULL;
+	int res;
+	int i,j,k;
+	int good_open = 0;
+
+	libusb_get_device_descriptor(usb_dev, &desc);
+
+	if (libusb_get_active_config_descriptor(usb_dev, &conf_desc) < 0)
+		return -1;
+	for (j = 0; j < conf_desc->bNumInterfaces && !good_open; j++) {
+		const struct libusb_interface *intf = &conf_desc->interface[j];
+		for (k = 0; k < intf->num_altsetting; k++) {
+			const struct libusb_interface_descriptor *intf_desc;
+			intf_desc = &intf->altsetting[k];
+			if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID &&
+			    intf_desc->bInterfaceNumber == interface_number) {
+				/* Matched Paths. Open this device */
+
+				/* OPEN HERE */
+				res = libusb_open(usb_dev, &dev->device_handle);
+				if (res < 0) {
+					LOG("can't open device\n");
+					break;
+				}
+				good_open = 1;
+#ifdef DETACH_KERNEL_DRIVER
+				/* Detach the kernel driver, but only if the
+				   device is managed by the kernel */
+				if (libusb_kernel_driver_active(dev->device_handle, intf_desc->bInterfaceNumber) == 1) {
+					res = libusb_detach_kernel_driver(dev->device_handle, intf_desc->bInterfaceNumber);
+					if (res < 0) {
+						libusb_close(dev->device_handle);
+						LOG("Unable to detach Kernel Driver\n");
+						good_open = 0;
+						break;
+					}
+				}
+#endif
+				res = libusb_claim_interface(dev->device_handle, intf_desc->bInterfaceNumber);
+				if (res < 0) {
+					LOG("can't claim interface %d: %d\n", intf_desc->bInterfaceNumber, res);
+					libusb_close(dev->device_handle);
+					good_open = 0;
+					break;
+				}
+
+				/* Store off the string descriptor indexes */
+				dev->manufacturer_index = desc.iManufacturer;
+				dev->product_index      = desc.iProduct;
+				dev->serial_index       = desc.iSerialNumber;
+
+				/* Store off the interface number */
+				dev->interface = intf_desc->bInterfaceNumber;
+
+				/* Find the INPUT and OUTPUT endpoints. An
+				   OUTPUT endpoint is not required. */
+				for (i = 0; i < intf_desc->bNumEndpoints; i++) {
+					const struct libusb_endpoint_descriptor *ep
+						= &intf_desc->endpoint[i];
+
+					/* Determine the type and direction of this
+					   endpoint. */
+					int is_interrupt =
+						(ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+					      == LIBUSB_TRANSFER_TYPE_INTERRUPT;
+					int is_output =
+						(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+					      == LIBUSB_ENDPOINT_OUT;
+					int is_input =
+						(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+					      == LIBUSB_ENDPOINT_IN;
+
+					/* Decide whether to use it for intput or output. */
+					if (dev->input_endpoint == 0 &&
+					    is_interrupt && is_input) {
+						/* Use this endpoint for INPUT */
+						dev->input_endpoint = ep->bEndpointAddress;
+						dev->input_ep_max_packet_size = ep->wMaxPacketSize;
+					}
+					if (dev->output_endpoint == 0 &&
+					    is_interrupt && is_output) {
+						/* Use this endpoint for OUTPUT */
+						dev->output_endpoint = ep->bEndpointAddress;
+					}
+				}
+
+				if (start_reading(dev) < 0) {
+					LOG("can't start reading interface %d\n", dev->interface);
+					libusb_release_interface(dev->device_handle, dev->interface);
+					libusb_close(dev->device_handle);
+					good_open = 0;
+				}
 
-			/* Break out of this loop only on fatal error.*/
-			if (res != LIBUSB_ERROR_BUSY &&
-			    res != LIBUSB_ERROR_TIMEOUT &&
-			    res != LIBUSB_ERROR_OVERFLOW &&
-			    res != LIBUSB_ERROR_INTERRUPTED) {
 				break;
 			}
 		}
 	}
+	libusb_free_config_descriptor(conf_desc);
 
-	/* Cancel any transfer that may be pending. This call will fail
-	   if no transfers are pending, but that's OK. */
-	if (libusb_cancel_transfer(dev->transfer) == 0) {
-		/* The transfer was cancelled, so wait for its completion. */
-		libusb_handle_events(usb_context);
-	}
-
-	/* Now that the read thread is stopping, Wake any threads which are
-	   waiting on data (in hid_read_timeout()). Do this under a mutex to
-	   make sure that a thread which is about to go to sleep waiting on
-	   the condition acutally will go to sleep before the condition is
-	   signaled. */
-	pthread_mutex_lock(&dev->mutex);
-	pthread_cond_broadcast(&dev->condition);
-	pthread_mutex_unlock(&dev->mutex);
-
-	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
-	   in hid_close(). They are not cleaned up here because this thread
-	   could end either due to a disconnect or due to a user
-	   call to hid_close(). In both cases the objects can be safely
-	   cleaned up after the call to pthread_join() (in hid_close()), but
-	   since hid_close() calls libusb_cancel_transfer(), on these objects,
-	   they can not be cleaned up here. */
-
-	return NULL;
+	return good_open ? 0 : -1;
 }
 
 
@@ -780,123 +1163,35 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 {
 	hid_device *dev = NULL;
 
-	libusb_device **devs;
 	libusb_device *usb_dev;
-	int res;
-	int d = 0;
+	unsigned int bus, address, interface_number;
+	int len = 0;
+	int attempt;
 	int good_open = 0;
 
-	dev = new_hid_device();
+	/* Paths are made by make_path(): bus:address:interface */
+	if (sscanf(path, "%x:%x:%x%n", &bus, &address, &interface_number, &len) != 3 ||
+	    path[len] != '\0' || bus > 0xff || address > 0xff)
+		return NULL;
 
 	if(hid_init() < 0)
 		return NULL;
 
-	libusb_get_device_list(usb_context, &devs);
-	while ((usb_dev = devs[d++]) != NULL) {
-		struct libusb_device_descriptor desc;
-		struct libusb_config_descriptor *conf_desc = NULL;
-		int i,j,k;
-		libusb_get_device_descriptor(usb_dev, &desc);
-
-		if (libusb_get_active_config_descriptor(usb_dev, &conf_desc) < 0)
-			continue;
-		for (j = 0; j < conf_desc->bNumInterfaces; j++) {
-			const struct libusb_interface *intf = &conf_desc->interface[j];
-			for (k = 0; k < intf->num_altsetting; k++) {
-				const struct libusb_interface_descriptor *intf_desc;
-				intf_desc = &intf->altsetting[k];
-				if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
-					char *dev_path = make_path(usb_dev, intf_desc->bInterfaceNumber);
-					if (!strcmp(dev_path, path)) {
-						/* Matched Paths. Open this device */
-
-						/* OPEN HERE */
-						res = libusb_open(usb_dev, &dev->device_handle);
-						if (res < 0) {
-							LOG("can't open device\n");
-							free(dev_path);
-							break;
-						}
-						good_open = 1;
-#ifdef DETACH_KERNEL_DRIVER
-						/* Detach the kernel driver, but only if the
-						   device is managed by the kernel */
-						if (libusb_kernel_driver_active(dev->device_handle, intf_desc->bInterfaceNumber) == 1) {
-							res = libusb_detach_kernel_driver(dev->device_handle, intf_desc->bInterfaceNumber);
-							if (res < 0) {
-								libusb_close(dev->device_handle);
-								LOG("Unable to detach Kernel Driver\n");
-								free(dev_path);
-								good_open = 0;
-								break;
-							}
-						}
-#endif
-						res = libusb_claim_interface(dev->device_handle, intf_desc->bInterfaceNumber);
-						if (res < 0) {
-							LOG("can't claim interface %d: %d\n", intf_desc->bInterfaceNumber, res);
-							free(dev_path);
-							libusb_close(dev->device_handle);
-							good_open = 0;
-							break;
-						}
-
-						/* Store off the string descriptor indexes */
-						dev->manufacturer_index = desc.iManufacturer;
-						dev->product_index      = desc.iProduct;
-						dev->serial_index       = desc.iSerialNumber;
-
-						/* Store off the interface number */
-						dev->interface = intf_desc->bInterfaceNumber;
-
-						/* Find the INPUT and OUTPUT endpoints. An
-						   OUTPUT endpoint is not required. */
-						for (i = 0; i < intf_desc->bNumEndpoints; i++) {
-							const struct libusb_endpoint_descriptor *ep
-								= &intf_desc->endpoint[i];
-
-							/* Determine the type and direction of this
-							   endpoint. */
-							int is_interrupt =
-								(ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
-							      == LIBUSB_TRANSFER_TYPE_INTERRUPT;
-							int is_output =
-								(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
-							      == LIBUSB_ENDPOINT_OUT;
-							int is_input =
-								(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
-							      == LIBUSB_ENDPOINT_IN;
-
-							/* Decide whether to use it for intput or output. */
-							if (dev->input_endpoint == 0 &&
-							    is_interrupt && is_input) {
-								/* Use this endpoint for INPUT */
-								dev->input_endpoint = ep->bEndpointAddress;
-								dev->input_ep_max_packet_size = ep->wMaxPacketSize;
-							}
-							if (dev->output_endpoint == 0 &&
-							    is_interrupt && is_output) {
-								/* Use this endpoint for OUTPUT */
-								dev->output_endpoint = ep->bEndpointAddress;
-							}
-						}
-
-						pthread_create(&dev->thread, NULL, read_thread, dev);
-
-						/* Wait here for the read thread to be initialized. */
-						pthread_barrier_wait(&dev->barrier);
+	dev = new_hid_device();
 
-					}
-					free(dev_path);
-				}
-			}
+	/* Try the cached index first. If the device is missing or can not be
+	   opened (the index may be stale without hotplug), rebuild and retry. */
+	for (attempt = 0; attempt < 2 && !good_open; attempt++) {
+		int rebuilt;
+		usb_dev = find_device((bus << 8) | address, attempt, &rebuilt);
+		if (usb_dev) {
+			good_open = !open_interface(dev, usb_dev, interface_number);
+			libusb_unref_device(usb_dev);
 		}
-		libusb_free_config_descriptor(conf_desc);
-
+		if (rebuilt)
+			break;
 	}
 
-	libusb_free_device_list(devs, 1);
-
 	/* If we have a good handle, return it. */
 	if (good_open) {
 		return dev;
@@ -911,6 +1206,14 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 
 int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
 {
+	return hid_write_timeout(dev, data, length, 1000);
+}
+
+
+int HID_API_EXPORT hid_write_timeout(hid_device *dev, const unsigned char *data, size_t length, int milliseconds)
+{
+	/* libusb has no "don't wait" timeout; 0 means wait forever. */
+	unsigned int timeout = milliseconds < 0 ? 0 : milliseconds == 0 ? 1 : milliseconds;
 	int res;
 	int report_number = data[0];
 	int skipped_report_id = 0;
@@ -930,7 +1233,7 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 			(2/*HID output*/ << 8) | report_number,
 			dev->interface,
 			(unsigned char *)data, length,
-			1000/*timeout millis*/);
+			timeout);
 
 		if (res < 0)
 			return -1;
@@ -947,7 +1250,7 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 			dev->output_endpoint,
 			(unsigned char*)data,
 			length,
-			&actual_length, 1000);
+			&actual_length, timeout);
 
 		if (res < 0)
 			return -1;
@@ -959,19 +1262,54 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	}
 }
 
+/* Helper function, to simplify hid_read(). Returns non-zero if no input
+   report is queued. This should be called with dev->mutex locked. */
+static int ring_empty(hid_device *dev)
+{
+	return __atomic_load_n(&dev->ring_head, __ATOMIC_SEQ_CST) == dev->ring_tail;
+}
+
 /* Helper function, to simplify hid_read().
-   This should be called with dev->mutex locked. */
+   This should be called with dev->mutex locked and a report queued. */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
-	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
-	size_t len = (length < rpt->len)? length: rpt->len;
+	/* Copy the data out of the oldest slot into the return buffer
+	   (data), and hand the slot back to read_callback(). */
+	size_t slot = dev->ring_tail & (INPUT_RING_SLOTS - 1);
+	size_t len = (length < dev->ring_len[slot])? length: dev->ring_len[slot];
 	if (len > 0)
-		memcpy(data, rpt->data, len);
-	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+		memcpy(data, dev->ring_data + slot * dev->input_ep_max_packet_size, len);
+	__atomic_store_n(&dev->ring_tail, dev->ring_tail + 1, __ATOMIC_RELEASE);
+	return len;
+}
+
+/* Perform an IN transfer on the calling thread. The transfer always
+   requests a full packet (so a long report can not overflow it) and is
+   then copied out, like return_data(). */
+static int read_direct(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	int transferred = 0;
+	int res;
+	size_t len;
+
+	/* libusb has no "don't wait" timeout; 0 means wait forever. */
+	res = libusb_interrupt_transfer(dev->device_handle,
+		dev->input_endpoint,
+		dev->direct_buffer,
+		dev->input_ep_max_packet_size,
+		&transferred,
+		milliseconds < 0 ? 0 : milliseconds == 0 ? 1 : milliseconds);
+
+	if (res == LIBUSB_ERROR_TIMEOUT)
+		return 0;
+	if (res < 0) {
+		LOG("read_direct(): libusb reports error # %d\n", res);
+		return -1;
+	}
+
+	len = (length < (size_t)transferred)? length: (size_t)transferred;
+	if (len > 0)
+		memcpy(data, dev->direct_buffer, len);
 	return len;
 }
 
@@ -986,24 +1324,20 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 {
 	int bytes_read = -1;
 
-#if 0
-	int transferred;
-	int res = libusb_interrupt_transfer(dev->device_handle, dev->input_endpoint, data, length, &transferred, 5000);
-	LOG("transferred: %d\n", transferred);
-	return transferred;
-#endif
+	if (dev->direct_read)
+		return read_direct(dev, data, length, milliseconds);
 
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cleanup_push(&cleanup_mutex, dev);
 
 	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
+	if (!ring_empty(dev)) {
 		/* Return the first one */
 		bytes_read = return_data(dev, data, length);
 		goto ret;
 	}
 
-	if (dev->shutdown_thread) {
+	if (dev->shutdown_transfer) {
 		/* This means the device has been disconnected.
 		   An error code of -1 should be returned. */
 		bytes_read = -1;
@@ -1012,10 +1346,12 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
 	if (milliseconds == -1) {
 		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		__atomic_add_fetch(&dev->ring_waiters, 1, __ATOMIC_SEQ_CST);
+		while (ring_empty(dev) && !dev->shutdown_transfer) {
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
-		if (dev->input_reports) {
+		__atomic_sub_fetch(&dev->ring_waiters, 1, __ATOMIC_SEQ_CST);
+		if (!ring_empty(dev)) {
 			bytes_read = return_data(dev, data, length);
 		}
 	}
@@ -1023,7 +1359,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		/* Non-blocking, but called with timeout. */
 		int res;
 		struct timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
 		ts.tv_sec += milliseconds / 1000;
 		ts.tv_nsec += (milliseconds % 1000) * 1000000;
 		if (ts.tv_nsec >= 1000000000L) {
@@ -1031,16 +1367,17 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			ts.tv_nsec -= 1000000000L;
 		}
 
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		__atomic_add_fetch(&dev->ring_waiters, 1, __ATOMIC_SEQ_CST);
+		while (ring_empty(dev) && !dev->shutdown_transfer) {
 			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
 			if (res == 0) {
-				if (dev->input_reports) {
+				if (!ring_empty(dev)) {
 					bytes_read = return_data(dev, data, length);
 					break;
 				}
 
 				/* If we're here, there was a spurious wake up
-				   or the read thread was shutdown. Run the
+				   or the input transfer was stopped. Run the
 				   loop again (ie: don't break). */
 			}
 			else if (res == ETIMEDOUT) {
@@ -1054,6 +1391,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 				break;
 			}
 		}
+		__atomic_sub_fetch(&dev->ring_waiters, 1, __ATOMIC_SEQ_CST);
 	}
 	else {
 		/* Purely non-blocking */
@@ -1080,6 +1418,38 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 }
 
 
+int HID_API_EXPORT hid_set_direct_read(hid_device *dev, int direct)
+{
+	direct = !!direct;
+	if (direct == dev->direct_read)
+		return 0;
+
+	if (direct) {
+		/* Allocate the buffer first so failure leaves the device
+		   untouched. */
+		dev->direct_buffer = malloc(dev->input_ep_max_packet_size);
+		if (!dev->direct_buffer)
+			return -1;
+		stop_reading(dev);
+	}
+	else {
+		if (start_reading(dev) < 0)
+			return -1;
+		free(dev->direct_buffer);
+		dev->direct_buffer = NULL;
+	}
+	dev->direct_read = direct;
+
+	return 0;
+}
+
+
+unsigned long HID_API_EXPORT hid_get_input_overflow(hid_device *dev)
+{
+	return __atomic_load_n(&dev->ring_overflow, __ATOMIC_RELAXED);
+}
+
+
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	int res = -1;
@@ -1146,16 +1516,11 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	if (!dev)
 		return;
 
-	/* Cause read_thread() to stop. */
-	dev->shutdown_thread = 1;
-	libusb_cancel_transfer(dev->transfer);
-
-	/* Wait for read_thread() to end. */
-	pthread_join(dev->thread, NULL);
-
-	/* Clean up the Transfer objects allocated in read_thread(). */
-	free(dev->transfer->buffer);
-	libusb_free_transfer(dev->transfer);
+	/* Stop reading (unless reads are direct) and clear out the queue of
+	   received reports. */
+	if (!dev->direct_read)
+		stop_reading(dev);
+	free(dev->direct_buffer);
 
 	/* release the interface */
 	libusb_release_interface(dev->device_handle, dev->interface);
@@ -1163,13 +1528,6 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	/* Close the handle */
 	libusb_close(dev->device_handle);
 
-	/* Clear out the queue of received reports. */
-	pthread_mutex_lock(&dev->mutex);
-	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
-	}
-	pthread_mutex_unlock(&dev->mutex);
-
 	free_hid_device(dev);
 }
 
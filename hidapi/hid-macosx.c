@@ -815,6 +815,13 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	return set_report(dev, kIOHIDReportTypeOutput, data, length);
 }
 
+int HID_API_EXPORT hid_write_timeout(hid_device *dev, const unsigned char *data, size_t length, int milliseconds)
+{
+	/* IOHIDDeviceSetReport() is synchronous and has no timeout. */
+	(void) milliseconds;
+	return hid_write(dev, data, length);
+}
+
 /* Helper function, so that this isn't duplicated in hid_read(). */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
@@ -1064,6 +1071,27 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 }
 
 
+int HID_API_EXPORT HID_API_CALL hid_hotplug_generation(void)
+{
+	/* Hotplug notification is not implemented on this platform. */
+	return -1;
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_set_direct_read(hid_device *dev, int direct)
+{
+	/* Direct reads are not implemented on this platform. */
+	return direct ? -1 : 0;
+}
+
+
+unsigned long HID_API_EXPORT HID_API_CALL hid_get_input_overflow(hid_device *dev)
+{
+	/* Dropped reports are not counted on this platform. */
+	return 0;
+}
+
+
 
 
 
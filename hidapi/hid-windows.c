@@ -588,6 +588,12 @@ err:
 }
 
 int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	return hid_write_timeout(dev, data, length, -1);
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_write_timeout(hid_device *dev, const unsigned char *data, size_t length, int milliseconds)
 {
 	DWORD bytes_written;
 	BOOL res;
@@ -595,6 +601,7 @@ int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *
 	OVERLAPPED ol;
 	unsigned char *buf;
 	memset(&ol, 0, sizeof(ol));
+	ol.hEvent = CreateEvent(NULL, FALSE, FALSE /*inital state f=nonsignaled*/, NULL);
 
 	/* Make sure the right number of bytes are passed to WriteFile. Windows
 	   expects the number of bytes which are in the _longest_ report (plus
@@ -625,6 +632,16 @@ int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *
 		}
 	}
 
+	if (milliseconds >= 0 &&
+	    WaitForSingleObject(ol.hEvent, milliseconds) != WAIT_OBJECT_0) {
+		/* Timed out. Cancel the write and wait for it to stop using
+		   buf. */
+		CancelIo(dev->device_handle);
+		GetOverlappedResult(dev->device_handle, &ol, &bytes_written, TRUE/*wait*/);
+		bytes_written = -1;
+		goto end_of_function;
+	}
+
 	/* Wait here until the write is done. This makes
 	   hid_write() synchronous. */
 	res = GetOverlappedResult(dev->device_handle, &ol, &bytes_written, TRUE/*wait*/);
@@ -638,6 +655,7 @@ int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *
 end_of_function:
 	if (buf != data)
 		free(buf);
+	CloseHandle(ol.hEvent);
 
 	return bytes_written;
 }
@@ -850,6 +868,27 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 }
 
 
+int HID_API_EXPORT HID_API_CALL hid_hotplug_generation(void)
+{
+	/* Hotplug notification is not implemented on this platform. */
+	return -1;
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_set_direct_read(hid_device *dev, int direct)
+{
+	/* Direct reads are not implemented on this platform. */
+	return direct ? -1 : 0;
+}
+
+
+unsigned long HID_API_EXPORT HID_API_CALL hid_get_input_overflow(hid_device *dev)
+{
+	/* Dropped reports are not counted on this platform. */
+	return 0;
+}
+
+
 /*#define PICPGM*/
 /*#define S11*/
 #define P32
@@ -141,6 +141,23 @@ extern "C" {
 		*/
 		void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs);
 
+		/** @brief Get the HID device arrival/removal generation.
+
+			This function returns a counter which changes every time a
+			HID device is attached to or detached from the system. A
+			caller may cache the result of hid_enumerate() and only
+			enumerate again once the generation has changed. This is a
+			libfcd extension to HIDAPI.
+
+			@ingroup API
+
+			@returns
+				This function returns a non-negative generation counter,
+				or -1 if hotplug notification is not supported (in which
+				case the caller must enumerate every time).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hotplug_generation(void);
+
 		/** @brief Open a HID device using a Vendor ID (VID), Product ID
 			(PID) and optionally a serial number.
 
@@ -202,6 +219,25 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_write(hid_device *device, const unsigned char *data, size_t length);
 
+		/** @brief Write an Output report to a HID device with timeout.
+
+			Like hid_write(), but waits at most @p milliseconds for the
+			report to be sent (hid_write() waits up to 1000 ms on the
+			libusb backend). This is a libfcd extension to HIDAPI.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data The data to send, including the report number as
+				the first byte.
+			@param length The length in bytes of the data to send.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the actual number of bytes written and
+				-1 on error (including timeout).
+		*/
+		int  HID_API_EXPORT HID_API_CALL hid_write_timeout(hid_device *device, const unsigned char *data, size_t length, int milliseconds);
+
 		/** @brief Read an Input report from a HID device with timeout.
 
 			Input reports are returned
@@ -261,6 +297,46 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *device, int nonblock);
 
+		/** @brief Read input reports directly on the calling thread.
+
+			By default input reports are collected in the background
+			and queued until hid_read() is called. In direct mode
+			hid_read() and hid_read_timeout() instead perform the
+			transfer themselves, so no report arrives unless a read is
+			pending. This suits strict request/response protocols.
+			Any reports queued when direct mode is entered are
+			discarded. This is a libfcd extension to HIDAPI.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param direct enable or not direct reads
+			 - 1 to enable direct reads
+			 - 0 to disable direct reads.
+
+			@returns
+				This function returns 0 on success and -1 on error
+				(including if direct reads are not supported on this
+				platform).
+		*/
+		int  HID_API_EXPORT HID_API_CALL hid_set_direct_read(hid_device *device, int direct);
+
+		/** @brief Get the number of dropped input reports.
+
+			Input reports collected in the background are queued in a
+			fixed number of slots. A report which arrives while every
+			slot is full is dropped and counted. This is a libfcd
+			extension to HIDAPI.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns the number of input reports
+				dropped since the device was opened (always 0 on
+				platforms which do not count them).
+		*/
+		unsigned long  HID_API_EXPORT HID_API_CALL hid_get_input_overflow(hid_device *device);
+
 		/** @brief Send a Feature report to the device.
 
 			Feature reports are sent over the Control endpoint as a
@@ -45,6 +45,17 @@ extern "C"
 /*! FUNcube dongle USB product ID */
 #define FCD_USB_PID 0xfb56
 
+/*! Lowest total gain accepted by fcd_set_total_gain_dB() (in dB) */
+#define FCD_TOTAL_GAIN_MIN_DB 2
+/*! Highest total gain accepted by fcd_set_total_gain_dB() (in dB) */
+#define FCD_TOTAL_GAIN_MAX_DB 98
+
+/*! Most flash blocks fcd_bl_flash_verify_report() can map */
+#define FCD_VERIFY_MAX_BLOCKS 1024
+/*! Non-zero if block \p n differs in an \ref fcd_verify_report */
+#define FCD_VERIFY_BLOCK_DIFFERS(report, n) \
+	(((report)->bitmap[(n) / 8] >> ((n) % 8)) & 1)
+
 
 /*
  * Types
@@ -52,9 +63,18 @@ extern "C"
 
 /* Forward declaration of opaque FUNcube dongle structure */
 struct FCD_impl;
-/*! \brief Opaque FUNcube dongle handle */
+/*!
+ * \brief Opaque FUNcube dongle handle
+ * \note A handle may be shared by several threads: each command (and each
+ * \ref FCD_BATCH) runs as one uninterrupted transaction.
+ */
 typedef struct FCD_impl FCD;
 
+/* Forward declaration of opaque FUNcube dongle command batch structure */
+struct FCD_batch_impl;
+/*! \brief Opaque FUNcube dongle command batch (see fcd_batch_run()) */
+typedef struct FCD_batch_impl FCD_BATCH;
+
 /*!
  * \brief FUNcube dongle path callback function
  * \param[in]     path    path to a FUNcube dongle
@@ -64,6 +84,36 @@ typedef struct FCD_impl FCD;
  */
 typedef int (fcd_path_callback)(const char *path, void *context);
 
+/*!
+ * \brief FUNcube dongle open flags (combine with bitwise OR)
+ */
+typedef enum
+{
+	/*! \brief Default behavior (HID device is kept open until fcd_close()) */
+	FCD_OPEN_DEFAULT = 0,
+	/*! \brief Compatibility mode (HID device is opened for every command) */
+	FCD_OPEN_TRANSIENT = 1<<0,
+	/*!
+	 * \brief Read responses on the calling thread (no background reader)
+	 * \note Ignored where the HID backend does not support it.
+	 */
+	FCD_OPEN_DIRECT = 1<<1,
+	/*!
+	 * \brief Also serialize commands with other processes using this flag
+	 * \note Uses an advisory lock file (named after the device path) in
+	 * \c $XDG_RUNTIME_DIR, else \c $TMPDIR (or \c /tmp). The file is only
+	 * accessible to the user who created it, and opening fails if it is a
+	 * symbolic link. Opening also fails where locking is not supported.
+	 */
+	FCD_OPEN_LOCK = 1<<2,
+	/*!
+	 * \brief Always query the device (do not keep a shadow of tuner state)
+	 * \note Use when something else may also change the device settings.
+	 * Implied by \ref FCD_OPEN_TRANSIENT.
+	 */
+	FCD_OPEN_NO_CACHE = 1<<3
+} FCD_OPEN_FLAG_ENUM;
+
 /*!
  * \brief FUNcube dongle get/set 1-byte value identifiers
  * \note Values, names, and descriptions are derived from \c FCHID008.zip.
@@ -108,6 +158,140 @@ typedef enum
 	FCD_VALUE_UNDEFINED
 } FCD_VALUE_ENUM;
 
+/*! \brief Front-end settings for a frequency (see fcd_plan_front_end()) */
+typedef struct
+{
+	/*! \brief RF band (\ref FCD_TUNER_BAND_ENUM) */
+	unsigned char band;
+	/*! \brief RF filter (\ref FCD_TUNER_RF_FILTER_ENUM, for \p band) */
+	unsigned char rf_filter;
+	/*! \brief Bias current (\ref FCD_TUNER_BIAS_CURRENT_ENUM) */
+	unsigned char bias_current;
+} fcd_front_end;
+
+/*!
+ * \brief Gain distributions for fcd_set_total_gain_dB()
+ */
+typedef enum
+{
+	/*! \brief Gain as early in the chain as possible (lowest noise figure) */
+	FCD_GAIN_NOISE_FIGURE = 0,
+	/*! \brief Gain as late in the chain as possible (best linearity) */
+	FCD_GAIN_LINEARITY
+} FCD_GAIN_MODE_ENUM;
+
+/*!
+ * \brief FUNcube dongle asynchronous completion callback function
+ * \param[in]     dev     \ref FCD the command was submitted on
+ * \param         status  command status (0 success, non-0 failure)
+ * \param         value   command output (value or frequency in Hz, else 0)
+ * \param[in,out] context user context pointer
+ * \note Called from fcd_async_dispatch() on the caller's thread.
+ * \note fcd_close() runs outstanding commands before returning, so \p dev
+ * may already be closed; use it for identification only.
+ */
+typedef void (fcd_async_callback)(FCD *dev, int status, unsigned int value,
+	void *context);
+
+/*! \brief Result of one command in an \ref FCD_BATCH */
+typedef struct
+{
+	/*! \brief Command status (0 success, non-0 failure) */
+	int status;
+	/*! \brief First output (value, frequency in Hz, DC I, or I/Q phase) */
+	long value;
+	/*! \brief Second output (DC Q or I/Q gain, otherwise 0) */
+	long value2;
+} fcd_batch_result;
+
+/*! \brief Complete tuner state (see fcd_get_state() and fcd_set_state()) */
+typedef struct
+{
+	/*! \brief 1-byte values, including bias tee (by \ref FCD_VALUE_ENUM) */
+	unsigned char value[FCD_VALUE_UNDEFINED];
+	/*! \brief Frequency (in Hz) */
+	unsigned int frequency_Hz;
+	/*! \brief DC correction (I) */
+	int dc_i;
+	/*! \brief DC correction (Q) */
+	int dc_q;
+	/*! \brief I/Q correction (phase) */
+	int iq_phase;
+	/*! \brief I/Q correction (gain) */
+	unsigned int iq_gain;
+} fcd_state;
+
+/*! \brief One step of a frequency sweep (see fcd_sweep()) */
+typedef struct
+{
+	/*! \brief Step number (from 0) */
+	unsigned int index;
+	/*! \brief Requested frequency (in Hz) */
+	unsigned int frequency_Hz;
+	/*! \brief Frequency reported by the device (in Hz) */
+	unsigned int actual_Hz;
+	/*! \brief Monotonic time the device confirmed the retune (in seconds) */
+	double time;
+	/*! \brief Steps per second achieved so far */
+	double rate;
+} fcd_sweep_step;
+
+/*!
+ * \brief FUNcube dongle frequency sweep callback function
+ * \param[in,out] dev     \ref FCD being swept
+ * \param[in]     step    step just completed
+ * \param[in,out] context user context pointer
+ * \retval 0     continue sweep
+ * \retval non-0 stop sweep
+ */
+typedef int (fcd_sweep_callback)(FCD *dev, const fcd_sweep_step *step,
+	void *context);
+
+/*! \brief One IF RSSI and PLL lock sample (see fcd_monitor_start()) */
+typedef struct
+{
+	/*! \brief Monotonic time the sample was taken (in seconds) */
+	double time;
+	/*! \brief Poll status (0 success, non-0 failure) */
+	int status;
+	/*! \brief IF RSSI (see fcd_get_if_rssi()) */
+	unsigned char rssi;
+	/*! \brief PLL lock state (see fcd_get_pll_lock()) */
+	unsigned char pll_lock;
+	/*! \brief Samples dropped (ring full) just before this one */
+	unsigned int dropped;
+} fcd_monitor_sample;
+
+/*! \brief Flash verify result (see fcd_bl_flash_verify_report()) */
+typedef struct
+{
+	/*! \brief Start of flash range (address of block 0) */
+	unsigned int start;
+	/*! \brief Number of 48-byte blocks in flash range */
+	unsigned int blocks;
+	/*! \brief CRC-32 of flash contents (as zlib crc32()) */
+	unsigned int flash_crc;
+	/*! \brief CRC-32 of the image over the flash range */
+	unsigned int image_crc;
+	/*! \brief Number of blocks that differ */
+	unsigned int mismatches;
+	/*! \brief Blocks that differ (see \ref FCD_VERIFY_BLOCK_DIFFERS) */
+	unsigned char bitmap[FCD_VERIFY_MAX_BLOCKS / 8];
+} fcd_verify_report;
+
+/*! \brief PLL settle statistics for one band (see fcd_retune()) */
+typedef struct
+{
+	/*! \brief Number of retunes that reached lock */
+	unsigned int count;
+	/*! \brief Shortest settle time (in us) */
+	unsigned int min_us;
+	/*! \brief Mean settle time (in us) */
+	unsigned int mean_us;
+	/*! \brief Longest settle time (in us) */
+	unsigned int max_us;
+} fcd_settle_stats;
+
 
 /*
  * Functions
@@ -131,6 +315,15 @@ extern API int fcd_for_each(fcd_path_callback *fn, void *context);
  */
 extern API FCD * fcd_open(const char *path);
 
+/*!
+ * \brief Open a FUNcube dongle device with flags
+ * \param[in] path  USB path uniquely identifying device (or \c NULL for any)
+ * \param     flags open flags (\ref FCD_OPEN_FLAG_ENUM)
+ * \retval non-NULL pointer to new open \ref FCD
+ * \retval NULL     error
+ */
+extern API FCD * fcd_open_flags(const char *path, unsigned int flags);
+
 /*!
  * \brief Close a FUNcube dongle device
  * \param[in,out] dev open \ref FCD (or \c NULL)
@@ -140,6 +333,43 @@ extern API FCD * fcd_open(const char *path);
  */
 extern API void fcd_close(FCD *dev);
 
+/*!
+ * \brief Set per-command timeouts of a FUNcube dongle device
+ * \param[in,out] dev      open \ref FCD
+ * \param         write_ms command send timeout (in ms, -1 for forever)
+ * \param         read_ms  response timeout (in ms, -1 for forever)
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note The defaults are 1000 ms to send and forever for the response. A
+ * command whose response times out fails with \c errno set to \c ETIMEDOUT.
+ * \note Flash erase can take longer than other commands to respond.
+ */
+extern API int fcd_set_timeouts(FCD *dev, int write_ms, int read_ms);
+
+/*!
+ * \brief Get the number of input reports dropped for a FUNcube dongle device
+ * \param[in,out] dev   open \ref FCD
+ * \param[out]    count reports dropped since \p dev was opened
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Responses are queued as they arrive; one that arrives while the
+ * queue is full is dropped, and its command then times out. Always 0 on
+ * platforms which do not count dropped reports.
+ */
+extern API int fcd_get_input_overflow(FCD *dev, unsigned long *count);
+
+/*!
+ * \brief Forget the shadow of tuner state of a FUNcube dongle device
+ * \param[in,out] dev open \ref FCD
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Values, frequency, and corrections set or read through \p dev are
+ * remembered: gets are answered without USB traffic, and sets that would not
+ * change anything are skipped. After this call, the next get of each queries
+ * the device again and the next set of each is always sent.
+ */
+extern API int fcd_invalidate(FCD *dev);
+
 /*!
  * \brief Query a FUNcube dongle device
  * \param[in,out] dev open \ref FCD (or \c NULL)
@@ -213,6 +443,40 @@ extern API int fcd_bl_write_block(FCD *dev, const unsigned char *block);
 extern API int fcd_bl_flash_write(FCD *dev, const unsigned char *data,
 	unsigned int size);
 
+/*!
+ * \brief Write new application to FUNcube dongle with several blocks in flight
+ * \param[in,out] dev          open \ref FCD
+ * \param[in]     data         flash image data
+ * \param         size         size of \p data
+ * \param[out]    blocks_per_s write rate achieved (in 48-byte blocks per
+ *                             second, or \c NULL)
+ * \pre FUNcube dongle must be in bootloader
+ * \retval 0     success
+ * \retval non-0 failure (as fcd_bl_flash_write())
+ * \note The device is held open throughout, even if opened with
+ * \ref FCD_OPEN_TRANSIENT.
+ */
+extern API int fcd_bl_flash_write_pipelined(FCD *dev,
+	const unsigned char *data, unsigned int size, double *blocks_per_s);
+
+/*!
+ * \brief Write new application to FUNcube dongle, verifying as it goes
+ * \param[in,out] dev      open \ref FCD
+ * \param[in]     data     flash image data
+ * \param         size     size of \p data
+ * \param[out]    rewrites number of windows written again after reading
+ *                         back wrong (or \c NULL)
+ * \pre FUNcube dongle must be in bootloader
+ * \retval 0     success (flash matches \p data)
+ * \retval non-0 failure (as fcd_bl_flash_write(), or -6 if a window still
+ *               reads back wrong after several writes)
+ * \note Flash is written and read back in windows of several blocks, each
+ * as one pipelined sequence, replacing a separate fcd_bl_flash_verify().
+ * Rewrites are not preceded by an erase.
+ */
+extern API int fcd_bl_flash_write_verified(FCD *dev,
+	const unsigned char *data, unsigned int size, unsigned int *rewrites);
+
 /*!
  * \brief Verify application from FUNcube dongle
  * \param[in,out] dev  open \ref FCD
@@ -225,6 +489,48 @@ extern API int fcd_bl_flash_write(FCD *dev, const unsigned char *data,
 extern API int fcd_bl_flash_verify(FCD *dev, const unsigned char *data,
 	unsigned int size);
 
+/*!
+ * \brief Get CRC-32 of application flash contents
+ * \param[in,out] dev open \ref FCD
+ * \param[out]    crc CRC-32 (as zlib crc32()) of the whole flash range
+ * \pre FUNcube dongle must be in bootloader
+ * \retval 0     success
+ * \retval non-0 failure (as fcd_bl_flash_verify())
+ * \note Flash is read back with several blocks in flight.
+ */
+extern API int fcd_bl_flash_crc32(FCD *dev, unsigned int *crc);
+
+/*!
+ * \brief Check whether FUNcube dongle already holds an application
+ * \param[in,out] dev  open \ref FCD
+ * \param[in]     data flash image data
+ * \param         size size of \p data
+ * \pre FUNcube dongle must be in bootloader
+ * \retval 1  flash contents match \p data (block by block)
+ * \retval 0  flash contents differ
+ * \retval <0 failure (as fcd_bl_flash_verify())
+ */
+extern API int fcd_bl_flash_is_current(FCD *dev, const unsigned char *data,
+	unsigned int size);
+
+/*!
+ * \brief Verify application from FUNcube dongle, finding every difference
+ * \param[in,out] dev    open \ref FCD
+ * \param[in]     data   flash image data
+ * \param         size   size of \p data
+ * \param[out]    report digests of flash and image, and blocks that differ
+ * \pre FUNcube dongle must be in bootloader
+ * \retval 0  flash matches \p data
+ * \retval 1  flash differs from \p data (see \p report)
+ * \retval -2 flash range is invalid, or holds more than
+ *            \ref FCD_VERIFY_MAX_BLOCKS blocks
+ * \retval <0 failure (as fcd_bl_flash_verify())
+ * \note Flash is read back once, with several blocks in flight, and compared
+ * as it arrives.
+ */
+extern API int fcd_bl_flash_verify_report(FCD *dev, const unsigned char *data,
+	unsigned int size, fcd_verify_report *report);
+
 /*!
  * \brief Set DC offset correction values
  * \param[in,out] dev  open \ref FCD
@@ -292,6 +598,19 @@ extern API int fcd_get_bias_tee(FCD *dev, unsigned char *state);
  */
 extern API int fcd_set_frequency_Hz(FCD *dev, unsigned int freq);
 
+/*!
+ * \brief Set frequency (in Hz), reporting the frequency actually set
+ * \param[in,out] dev    open \ref FCD
+ * \param         freq   frequency (in Hz)
+ * \param[out]    actual frequency set by the device (in Hz, or \c NULL)
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note \p actual comes from the response to the set itself. A later
+ * fcd_get_frequency_Hz() is answered from it without a command.
+ */
+extern API int fcd_set_frequency_Hz_actual(FCD *dev, unsigned int freq,
+	unsigned int *actual);
+
 /*!
  * \brief Get frequency (in Hz)
  * \param[in,out] dev  open \ref FCD
@@ -301,6 +620,24 @@ extern API int fcd_set_frequency_Hz(FCD *dev, unsigned int freq);
  */
 extern API int fcd_get_frequency_Hz(FCD *dev, unsigned int *freq);
 
+/*!
+ * \brief Get IF RSSI
+ * \param[in,out] dev  open \ref FCD
+ * \param[out]    rssi RSSI output (-35 dBm ~= 0, -10 dBm ~= 70)
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+extern API int fcd_get_if_rssi(FCD *dev, unsigned char *rssi);
+
+/*!
+ * \brief Get PLL lock state
+ * \param[in,out] dev    open \ref FCD
+ * \param[out]    locked state output (1 locked, 0 unlocked)
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+extern API int fcd_get_pll_lock(FCD *dev, unsigned char *locked);
+
 /*!
  * \brief Set 1-byte value
  * \param[in,out] dev   open \ref FCD
@@ -321,6 +658,395 @@ extern API int fcd_set_value(FCD *dev, FCD_VALUE_ENUM id, unsigned char value);
  */
 extern API int fcd_get_value(FCD *dev, FCD_VALUE_ENUM id, unsigned char *value);
 
+/*!
+ * \brief Create an empty command batch
+ * \retval non-NULL pointer to new \ref FCD_BATCH
+ * \retval NULL     error
+ */
+extern API FCD_BATCH * fcd_batch_new(void);
+
+/*!
+ * \brief Free a command batch
+ * \param[in,out] batch \ref FCD_BATCH (or \c NULL)
+ * \post \p batch is no longer valid
+ */
+extern API void fcd_batch_free(FCD_BATCH *batch);
+
+/*!
+ * \brief Remove all commands from a batch
+ * \param[in,out] batch \ref FCD_BATCH
+ */
+extern API void fcd_batch_clear(FCD_BATCH *batch);
+
+/*!
+ * \brief Get the number of commands in a batch
+ * \param[in] batch \ref FCD_BATCH
+ * \returns number of queued commands
+ */
+extern API unsigned int fcd_batch_size(const FCD_BATCH *batch);
+
+/*!
+ * \brief Queue a 1-byte value set (see fcd_set_value())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \param         id    value identifier
+ * \param         value new value
+ * \retval >=0 index of command (and of its \ref fcd_batch_result)
+ * \retval -1  failure
+ */
+extern API int fcd_batch_set_value(FCD_BATCH *batch, FCD_VALUE_ENUM id,
+	unsigned char value);
+
+/*!
+ * \brief Queue a 1-byte value get (see fcd_get_value())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \param         id    value identifier
+ * \retval >=0 index of command (value is returned in \p value)
+ * \retval -1  failure
+ */
+extern API int fcd_batch_get_value(FCD_BATCH *batch, FCD_VALUE_ENUM id);
+
+/*!
+ * \brief Queue a frequency set (see fcd_set_frequency_Hz_actual())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \param         freq  frequency (in Hz)
+ * \retval >=0 index of command (frequency set is returned in \p value)
+ * \retval -1  failure
+ */
+extern API int fcd_batch_set_frequency_Hz(FCD_BATCH *batch, unsigned int freq);
+
+/*!
+ * \brief Queue a frequency set with matching front-end settings
+ * \param[in,out] batch \ref FCD_BATCH
+ * \param         freq  frequency (in Hz)
+ * \retval >=0 index of frequency set (band, RF filter, and bias current sets
+ *             follow it)
+ * \retval -1  failure
+ * \see fcd_plan_front_end()
+ */
+extern API int fcd_batch_set_frequency_Hz_planned(FCD_BATCH *batch,
+	unsigned int freq);
+
+/*!
+ * \brief Queue a frequency get (see fcd_get_frequency_Hz())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \retval >=0 index of command (frequency is returned in \p value)
+ * \retval -1  failure
+ */
+extern API int fcd_batch_get_frequency_Hz(FCD_BATCH *batch);
+
+/*!
+ * \brief Queue a DC offset correction set (see fcd_set_dc_correction())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \param         i     DC I correction value (-32768..32767)
+ * \param         q     DC Q correction value (-32768..32767)
+ * \retval >=0 index of command
+ * \retval -1  failure
+ */
+extern API int fcd_batch_set_dc_correction(FCD_BATCH *batch, int i, int q);
+
+/*!
+ * \brief Queue a DC offset correction get (see fcd_get_dc_correction())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \retval >=0 index of command (I and Q are returned in \p value and
+ * \p value2)
+ * \retval -1  failure
+ */
+extern API int fcd_batch_get_dc_correction(FCD_BATCH *batch);
+
+/*!
+ * \brief Queue an I/Q balance set (see fcd_set_iq_correction())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \param         phase phase correction value (-32768..32767)
+ * \param         gain  gain correction value (0..65535)
+ * \retval >=0 index of command
+ * \retval -1  failure
+ */
+extern API int fcd_batch_set_iq_correction(FCD_BATCH *batch, int phase,
+	unsigned int gain);
+
+/*!
+ * \brief Queue an I/Q balance get (see fcd_get_iq_correction())
+ * \param[in,out] batch \ref FCD_BATCH
+ * \retval >=0 index of command (phase and gain are returned in \p value and
+ * \p value2)
+ * \retval -1  failure
+ */
+extern API int fcd_batch_get_iq_correction(FCD_BATCH *batch);
+
+/*!
+ * \brief Run all commands in a batch as one pipelined sequence
+ * \param[in,out] dev     open \ref FCD
+ * \param[in]     batch   \ref FCD_BATCH
+ * \param[out]    results one result per queued command (or \c NULL)
+ * \retval 0     success (all commands succeeded)
+ * \retval non-0 failure (see each result's \p status)
+ * \note The batch is left intact, so it may be run again.
+ */
+extern API int fcd_batch_run(FCD *dev, const FCD_BATCH *batch,
+	fcd_batch_result *results);
+
+/*!
+ * \brief Set frequency (in Hz) without blocking
+ * \param[in,out] dev     open \ref FCD
+ * \param         freq    frequency (in Hz)
+ * \param         fn      completion callback (or \c NULL, gets the
+ *                        frequency set as \p value)
+ * \param[in,out] context user context pointer for \p fn
+ * \retval 0     success (command queued)
+ * \retval non-0 failure
+ * \note Commands on one \ref FCD run in submission order on a thread owned
+ * by the handle; commands on different handles overlap.
+ */
+extern API int fcd_set_frequency_Hz_async(FCD *dev, unsigned int freq,
+	fcd_async_callback *fn, void *context);
+
+/*!
+ * \brief Get frequency (in Hz) without blocking
+ * \param[in,out] dev     open \ref FCD
+ * \param         fn      completion callback
+ * \param[in,out] context user context pointer for \p fn
+ * \retval 0     success (command queued)
+ * \retval non-0 failure
+ */
+extern API int fcd_get_frequency_Hz_async(FCD *dev, fcd_async_callback *fn,
+	void *context);
+
+/*!
+ * \brief Set 1-byte value without blocking
+ * \param[in,out] dev     open \ref FCD
+ * \param         id      value identifier
+ * \param         value   new value
+ * \param         fn      completion callback (or \c NULL)
+ * \param[in,out] context user context pointer for \p fn
+ * \retval 0     success (command queued)
+ * \retval non-0 failure
+ */
+extern API int fcd_set_value_async(FCD *dev, FCD_VALUE_ENUM id,
+	unsigned char value, fcd_async_callback *fn, void *context);
+
+/*!
+ * \brief Get 1-byte value without blocking
+ * \param[in,out] dev     open \ref FCD
+ * \param         id      value identifier
+ * \param         fn      completion callback
+ * \param[in,out] context user context pointer for \p fn
+ * \retval 0     success (command queued)
+ * \retval non-0 failure
+ */
+extern API int fcd_get_value_async(FCD *dev, FCD_VALUE_ENUM id,
+	fcd_async_callback *fn, void *context);
+
+/*!
+ * \brief Run completion callbacks for finished asynchronous commands
+ * \param timeout_ms time to wait for a completion (in ms, -1 for forever)
+ * \retval >=0 number of callbacks run
+ * \retval -1  failure
+ * \note Callbacks for every \ref FCD run on the thread calling this function.
+ */
+extern API int fcd_async_dispatch(int timeout_ms);
+
+/*!
+ * \brief Get complete tuner state
+ * \param[in,out] dev   open \ref FCD
+ * \param[out]    state tuner state
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+extern API int fcd_get_state(FCD *dev, fcd_state *state);
+
+/*!
+ * \brief Set complete tuner state, sending only what differs
+ * \param[in,out] dev   open \ref FCD
+ * \param[in]     state tuner state (e.g. from fcd_get_state())
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Frequency is set first (the device then picks band and RF filter),
+ * followed by band and RF filter, filters and modes, gains, corrections,
+ * and finally bias tee.
+ */
+extern API int fcd_set_state(FCD *dev, const fcd_state *state);
+
+/*!
+ * \brief Step frequency from \p start_Hz towards \p stop_Hz (inclusive)
+ * \param[in,out] dev      open \ref FCD
+ * \param         start_Hz first frequency (in Hz)
+ * \param         stop_Hz  last frequency (in Hz, may be below \p start_Hz)
+ * \param         step_Hz  frequency step (in Hz, non-zero)
+ * \param         dwell_ms time from one retune to the next (in ms, 0 for none)
+ * \param         fn       callback run after each retune
+ * \param[in,out] context  user context pointer for \p fn
+ * \retval 0     success (sweep completed or stopped by \p fn)
+ * \retval non-0 failure
+ * \note The handle is locked and its HID device held open for the whole
+ * sweep, even with \ref FCD_OPEN_TRANSIENT. Keep \p fn short: time spent
+ * in it is dead time between steps (unless within \p dwell_ms).
+ */
+extern API int fcd_sweep(FCD *dev, unsigned int start_Hz, unsigned int stop_Hz,
+	unsigned int step_Hz, unsigned int dwell_ms, fcd_sweep_callback *fn,
+	void *context);
+
+/*!
+ * \brief Start polling IF RSSI and PLL lock in the background
+ * \param[in,out] dev         open \ref FCD
+ * \param         interval_ms time between polls (in ms, 0 for as fast as
+ *                            the device answers, with a 1 ms gap)
+ * \retval 0     success
+ * \retval non-0 failure (\c EBUSY if already started)
+ * \note Samples are kept in a ring of recent samples; read them with
+ * fcd_monitor_read(). Other commands on \p dev run between polls.
+ */
+extern API int fcd_monitor_start(FCD *dev, unsigned int interval_ms);
+
+/*!
+ * \brief Stop polling started by fcd_monitor_start()
+ * \param[in,out] dev open \ref FCD
+ * \note Unread samples are discarded. Also done by fcd_close().
+ */
+extern API void fcd_monitor_stop(FCD *dev);
+
+/*!
+ * \brief Take samples from the background poll, without blocking
+ * \param[in,out] dev     open \ref FCD
+ * \param[out]    samples sample output (oldest first)
+ * \param         count   maximum number of samples
+ * \retval >=0 number of samples taken
+ * \retval -1  failure (\c ENOENT if not started)
+ * \note Call from one thread at a time, and not while fcd_monitor_stop()
+ * may run. Samples are dropped (see \p dropped) while the ring is full.
+ */
+extern API int fcd_monitor_read(FCD *dev, fcd_monitor_sample *samples,
+	unsigned int count);
+
+/*!
+ * \brief Start holding IF RSSI between \p low and \p high (inclusive)
+ * \param[in,out] dev  open \ref FCD
+ * \param         low  lowest IF RSSI to leave alone (see fcd_get_if_rssi())
+ * \param         high highest IF RSSI to leave alone
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Runs on the polling thread of fcd_monitor_start() (started if
+ * needed). Outside the window one gain stage is moved by one setting per
+ * poll: gain is taken from IF amplifiers 6 to 1 first, then mixer, then LNA,
+ * and given back in reverse order. Make the window wider than the largest
+ * gain step to avoid hunting.
+ * \note Calling again changes the window.
+ */
+extern API int fcd_agc_start(FCD *dev, unsigned char low, unsigned char high);
+
+/*!
+ * \brief Stop automatic gain control started by fcd_agc_start()
+ * \param[in,out] dev open \ref FCD
+ * \note Gains are left as they are. Also stopped by fcd_monitor_stop().
+ */
+extern API void fcd_agc_stop(FCD *dev);
+
+/*!
+ * \brief Set total gain (LNA, mixer, and IF amplifiers 1 to 6)
+ * \param[in,out] dev  open \ref FCD
+ * \param         dB   total gain (in dB, \ref FCD_TOTAL_GAIN_MIN_DB to
+ *                     \ref FCD_TOTAL_GAIN_MAX_DB)
+ * \param         mode gain distribution
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Every total in range is met exactly. Only stages that differ from
+ * the current settings are sent.
+ */
+extern API int fcd_set_total_gain_dB(FCD *dev, int dB,
+	FCD_GAIN_MODE_ENUM mode);
+
+/*!
+ * \brief Look up front-end settings for a frequency
+ * \param         freq frequency (in Hz)
+ * \param[out]    plan front-end settings
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note The RF filter nearest in frequency is picked within the band.
+ */
+extern API int fcd_plan_front_end(unsigned int freq, fcd_front_end *plan);
+
+/*!
+ * \brief Set frequency (in Hz) and matching front-end settings together
+ * \param[in,out] dev  open \ref FCD
+ * \param         freq frequency (in Hz)
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note All four commands are sent as one batch (see
+ * fcd_batch_set_frequency_Hz_planned()).
+ */
+extern API int fcd_set_frequency_Hz_planned(FCD *dev, unsigned int freq);
+
+/*!
+ * \brief Set frequency (in Hz) and wait for the PLL to lock
+ * \param[in,out] dev        open \ref FCD
+ * \param         freq       frequency (in Hz)
+ * \param         timeout_ms time to wait for lock (in ms, -1 for forever)
+ * \param[out]    settle_us  time from retune to confirmed lock (in us, 0 if
+ *                           already tuned to \p freq, or \c NULL)
+ * \retval 0     success (PLL locked)
+ * \retval non-0 failure (\c ETIMEDOUT if not locked in time)
+ * \note Lock is polled as fast as the device answers, starting after the
+ * shortest settle time seen so far in the band the device picked (see
+ * fcd_get_settle_stats()).
+ */
+extern API int fcd_retune(FCD *dev, unsigned int freq, int timeout_ms,
+	unsigned int *settle_us);
+
+/*!
+ * \brief Get PLL settle statistics gathered by fcd_retune()
+ * \param[in,out] dev   open \ref FCD
+ * \param         band  band (\ref FCD_TUNER_BAND_ENUM)
+ * \param[out]    stats statistics output
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+extern API int fcd_get_settle_stats(FCD *dev, unsigned int band,
+	fcd_settle_stats *stats);
+
+/*!
+ * \brief Measure and save the gain of every gain stage setting in every band
+ * \param[in,out] dev     open \ref FCD
+ * \param         samples IF RSSI samples averaged per measurement (1 to 64)
+ * \retval 0     success
+ * \retval non-0 failure (\c ENOTSUP if the device has no serial number,
+ *               or \p dev was opened with \ref FCD_OPEN_TRANSIENT)
+ * \note Gains are measured by IF RSSI relative to the settings on entry,
+ * which are restored afterwards. The results are saved to
+ * <tt>$LIBFCD_CALIBRATION_DIR/<serial>.cal</tt> (default directory
+ * <tt>$HOME/.libfcd</tt>, or <tt>%LOCALAPPDATA%\\libfcd</tt> on Windows),
+ * which every handle maps on its first gain conversion (transient handles
+ * use nominal gains).
+ */
+extern API int fcd_calibrate(FCD *dev, unsigned int samples);
+
+/*!
+ * \brief Check for a calibration file (see fcd_calibrate())
+ * \param[in,out] dev open \ref FCD
+ * \retval 0     not calibrated (nominal gains are used)
+ * \retval non-0 calibrated
+ */
+extern API int fcd_is_calibrated(FCD *dev);
+
+/*!
+ * \brief Get total gain (LNA, mixer, and IF amplifiers 1 to 6)
+ * \param[in,out] dev open \ref FCD
+ * \param[out]    dB  total gain (in dB)
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Calibrated gains are used if available (see fcd_calibrate()).
+ */
+extern API int fcd_get_gain_dB(FCD *dev, double *dB);
+
+/*!
+ * \brief Convert IF RSSI to signal level at the antenna input
+ * \param[in,out] dev  open \ref FCD
+ * \param         rssi IF RSSI (see fcd_get_if_rssi())
+ * \param[out]    dBm  signal level (in dBm)
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Approximate: IF RSSI is taken as linear over its 25 dB range.
+ */
+extern API int fcd_rssi_to_dBm(FCD *dev, unsigned char rssi, double *dBm);
+
 /*!
  * \brief Reset all FUNcube dongles to bootloader
  * \param delay_ms delay time after reset (in ms)
@@ -0,0 +1,104 @@
+/*! \file
+ * \brief FUNcube dongle automatic gain control implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> /* NULL */
+#include "fcd.h" /* FCD, fcd_get_value, fcd_set_value */
+#include "fcd_common.h"
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Find the current setting of a gain stage
+ * \param[in,out] dev   open \ref FCD
+ * \param[in]     stage gain stage
+ * \retval >=0 index into \p stage settings
+ * \retval -1  unknown (command failed or setting not in table)
+ * \note Normally answered from the shadow of tuner state (no command sent).
+ */
+static int fcd_agc_find(FCD *dev, const fcd_gain_stage *stage)
+{
+	unsigned char value;
+
+	if (fcd_get_value(dev, stage->id, &value))
+	{
+		return -1;
+	}
+	return fcd_gain_find(stage, value);
+}
+
+
+void fcd_agc_step(FCD *dev, unsigned char rssi, unsigned char low,
+	unsigned char high)
+{
+	const fcd_gain_stage *stage;
+	unsigned int step;
+	int index;
+
+	if (rssi >= low && rssi <= high)
+	{
+		/* inside the window: nothing to send */
+		return;
+	}
+	/* read and change gains as one transaction */
+	if (fcd_lock(dev))
+	{
+		return;
+	}
+
+	if (rssi > high)
+	{
+		/* take gain away from the back end first (the front end sets the
+		   noise figure) */
+		for (step = FCD_GAIN_STAGES; step-- > 0; )
+		{
+			stage = &fcd_gain_stages[step];
+			index = fcd_agc_find(dev, stage);
+			if (index > 0)
+			{
+				fcd_set_value(dev, stage->id, stage->settings[index - 1]);
+				break;
+			}
+		}
+	}
+	else
+	{
+		/* give gain back to the front end first */
+		for (step = 0; step < FCD_GAIN_STAGES; ++step)
+		{
+			stage = &fcd_gain_stages[step];
+			index = fcd_agc_find(dev, stage);
+			if (index >= 0 && (unsigned int) index + 1 < stage->count)
+			{
+				fcd_set_value(dev, stage->id, stage->settings[index + 1]);
+				break;
+			}
+		}
+	}
+
+	fcd_unlock(dev);
+}
@@ -135,9 +135,31 @@ API int fcd_get_bias_tee(FCD *dev, unsigned char *state)
 
 
 API int fcd_set_frequency_Hz(FCD *dev, unsigned int freq)
+{
+	/* the reported frequency still updates the shadow of tuner state */
+	return fcd_set_frequency_Hz_actual(dev, freq, NULL);
+}
+
+
+API int fcd_set_frequency_Hz_actual(FCD *dev, unsigned int freq,
+	unsigned int *actual)
 {
 	uint32_t fHz = convert_le_u32(freq);
-	return fcd_set(dev, FCD_CMD_SET_FREQUENCY_HZ, &fHz, sizeof(fHz));
+	uint32_t aHz;
+	int result;
+
+	result = fcd_io(dev, FCD_CMD_SET_FREQUENCY_HZ, 0, &fHz, sizeof(fHz), &aHz,
+		sizeof(aHz));
+	if (result)
+	{
+		return result;
+	}
+
+	if (NULL != actual)
+	{
+		*actual = convert_le_u32(aHz);
+	}
+	return 0;
 }
 
 
@@ -157,6 +179,28 @@ API int fcd_get_frequency_Hz(FCD *dev, unsigned int *freq)
 }
 
 
+API int fcd_get_if_rssi(FCD *dev, unsigned char *rssi)
+{
+	return fcd_get(dev, FCD_CMD_GET_IF_RSSI, rssi, 1);
+}
+
+
+API int fcd_get_pll_lock(FCD *dev, unsigned char *locked)
+{
+	unsigned char lock;
+	int result;
+
+	result = fcd_get(dev, FCD_CMD_GET_PLL_LOCK, &lock, 1);
+	if (result)
+	{
+		return result;
+	}
+
+	*locked = lock & 1;
+	return 0;
+}
+
+
 API int fcd_set_value(FCD *dev, FCD_VALUE_ENUM id, unsigned char value)
 {
 	if (id >= FCD_VALUE_UNDEFINED)
@@ -175,5 +219,5 @@ API int fcd_get_value(FCD *dev, FCD_VALUE_ENUM id, unsigned char *value)
 		errno = EINVAL;
 		return -1;
 	}
-	return fcd_get(dev, FCD_CMD_GET_VALUE_OFFSET + id, &value, 1);
+	return fcd_get(dev, FCD_CMD_GET_VALUE_OFFSET + id, value, 1);
 }
@@ -0,0 +1,438 @@
+/*! \file
+ * \brief FUNcube dongle asynchronous command implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <pthread.h> /* pthread_* */
+#include <stdlib.h> /* NULL, malloc, free */
+#include <string.h> /* memcpy */
+#include <time.h> /* struct timespec */
+#include "fcd.h" /* FCD, fcd_async_callback */
+#include "fcd_cmd.h" /* FCD_CMD_* */
+#include "fcd_common.h"
+
+
+/*
+ * Types
+ */
+
+
+/*! \brief Queued asynchronous command */
+typedef struct fcd_async_request
+{
+	/*! \brief Next request in queue */
+	struct fcd_async_request *next;
+	/*! \brief Device the request was submitted on */
+	FCD *dev;
+	/*! \brief Command ID */
+	unsigned char cmd;
+	/*! \brief Input data length */
+	unsigned char ilen;
+	/*! \brief Output data length */
+	unsigned char olen;
+	/*! \brief Input data (little-endian) */
+	unsigned char idata[4];
+	/*! \brief Output data (little-endian) */
+	unsigned char odata[4];
+	/*! \brief Command status */
+	int status;
+	/*! \brief Completion callback */
+	fcd_async_callback *fn;
+	/*! \brief Completion callback context */
+	void *context;
+} fcd_async_request;
+
+/*! \brief Queue of \ref fcd_async_request */
+typedef struct
+{
+	/*! \brief First request (or \c NULL) */
+	fcd_async_request *head;
+	/*! \brief Last request (or \c NULL) */
+	fcd_async_request *tail;
+} fcd_async_queue;
+
+/*! \brief Per-device asynchronous command worker */
+struct fcd_worker
+{
+	/*! \brief Worker thread */
+	pthread_t thread;
+	/*! \brief Protects \p pending and \p shutdown */
+	pthread_mutex_t lock;
+	/*! \brief Signaled when \p pending or \p shutdown changes */
+	pthread_cond_t cond;
+	/*! \brief Requests waiting to run */
+	fcd_async_queue pending;
+	/*! \brief Non-zero once the worker should exit */
+	int shutdown;
+};
+
+
+/*
+ * Variables
+ */
+
+
+/*! \brief Serializes worker creation and destruction */
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! \brief Process-wide queue of finished requests */
+static struct
+{
+	/*! \brief Protects \p queue */
+	pthread_mutex_t lock;
+	/*! \brief Signaled when a request is added to \p queue */
+	pthread_cond_t cond;
+	/*! \brief Finished requests */
+	fcd_async_queue queue;
+} completions = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	{NULL, NULL}};
+
+/*! \brief Sets up \p completions for monotonic timeouts */
+static pthread_once_t completions_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Set up \p completions (once per process, see \p completions_once)
+ */
+static void fcd_async_init(void)
+{
+	/* fcd_async_dispatch() timeouts follow the monotonic clock */
+	fcd_cond_init(&completions.cond);
+}
+
+
+/*!
+ * \brief Append a request to a queue
+ * \param[in,out] queue   queue
+ * \param[in,out] request request
+ */
+static void fcd_async_push(fcd_async_queue *queue, fcd_async_request *request)
+{
+	request->next = NULL;
+	if (NULL != queue->tail)
+	{
+		queue->tail->next = request;
+	}
+	else
+	{
+		queue->head = request;
+	}
+	queue->tail = request;
+}
+
+
+/*!
+ * \brief Asynchronous command worker thread
+ * \param[in,out] param open \ref FCD
+ * \returns \c NULL
+ */
+static void * fcd_worker_thread(void *param)
+{
+	FCD *dev = param;
+	struct fcd_worker *worker = dev->worker;
+
+	pthread_mutex_lock(&worker->lock);
+	for (;;)
+	{
+		fcd_async_request *request = worker->pending.head;
+		if (NULL == request)
+		{
+			if (worker->shutdown)
+			{
+				break;
+			}
+			pthread_cond_wait(&worker->cond, &worker->lock);
+			continue;
+		}
+		worker->pending.head = request->next;
+		if (NULL == worker->pending.head)
+		{
+			worker->pending.tail = NULL;
+		}
+		pthread_mutex_unlock(&worker->lock);
+
+		/* run command */
+		request->status = fcd_io(dev, request->cmd, 0, request->idata,
+			request->ilen, request->odata, request->olen);
+
+		/* hand over to fcd_async_dispatch() */
+		pthread_mutex_lock(&completions.lock);
+		fcd_async_push(&completions.queue, request);
+		pthread_cond_signal(&completions.cond);
+		pthread_mutex_unlock(&completions.lock);
+
+		pthread_mutex_lock(&worker->lock);
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+
+/*!
+ * \brief Get the asynchronous command worker of a device, starting it if needed
+ * \param[in,out] dev open \ref FCD
+ * \retval non-NULL worker
+ * \retval NULL     error
+ */
+static struct fcd_worker * fcd_worker_get(FCD *dev)
+{
+	struct fcd_worker *worker;
+
+	/* before any worker can signal completions */
+	pthread_once(&completions_once, fcd_async_init);
+
+	pthread_mutex_lock(&worker_lock);
+	worker = dev->worker;
+	if (NULL == worker)
+	{
+		worker = malloc(sizeof(*worker));
+		if (NULL != worker)
+		{
+			pthread_mutex_init(&worker->lock, NULL);
+			pthread_cond_init(&worker->cond, NULL);
+			worker->pending.head = NULL;
+			worker->pending.tail = NULL;
+			worker->shutdown = 0;
+			dev->worker = worker;
+			if (pthread_create(&worker->thread, NULL, fcd_worker_thread, dev))
+			{
+				dev->worker = NULL;
+				pthread_cond_destroy(&worker->cond);
+				pthread_mutex_destroy(&worker->lock);
+				free(worker);
+				worker = NULL;
+			}
+		}
+		if (NULL == worker)
+		{
+			errno = ENOMEM;
+		}
+	}
+	pthread_mutex_unlock(&worker_lock);
+
+	return worker;
+}
+
+
+void fcd_worker_stop(FCD *dev)
+{
+	struct fcd_worker *worker;
+
+	pthread_mutex_lock(&worker_lock);
+	worker = dev->worker;
+	dev->worker = NULL;
+	pthread_mutex_unlock(&worker_lock);
+
+	if (NULL != worker)
+	{
+		/* let the worker drain its queue, then exit */
+		pthread_mutex_lock(&worker->lock);
+		worker->shutdown = 1;
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->lock);
+		pthread_join(worker->thread, NULL);
+
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->lock);
+		free(worker);
+	}
+}
+
+
+/*!
+ * \brief Queue an asynchronous command
+ * \param[in,out] dev     open \ref FCD
+ * \param         cmd     command ID
+ * \param[in]     idata   input data pointer
+ * \param         ilen    input data length (at most 4)
+ * \param         olen    output data length (at most 4)
+ * \param         fn      completion callback (or \c NULL)
+ * \param[in,out] context completion callback context
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int fcd_async_submit(FCD *dev, unsigned char cmd, const void *idata,
+	unsigned char ilen, unsigned char olen, fcd_async_callback *fn,
+	void *context)
+{
+	struct fcd_worker *worker;
+	fcd_async_request *request;
+
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+
+	request = malloc(sizeof(*request));
+	if (NULL == request)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	request->dev = dev;
+	request->cmd = cmd;
+	request->ilen = ilen;
+	request->olen = olen;
+	if (ilen)
+	{
+		memcpy(request->idata, idata, ilen);
+	}
+	memset(request->odata, 0, sizeof(request->odata));
+	request->status = -1;
+	request->fn = fn;
+	request->context = context;
+
+	worker = fcd_worker_get(dev);
+	if (NULL == worker)
+	{
+		free(request);
+		return -1;
+	}
+
+	pthread_mutex_lock(&worker->lock);
+	fcd_async_push(&worker->pending, request);
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	return 0;
+}
+
+
+API int fcd_set_frequency_Hz_async(FCD *dev, unsigned int freq,
+	fcd_async_callback *fn, void *context)
+{
+	uint32_t fHz = convert_le_u32(freq);
+	return fcd_async_submit(dev, FCD_CMD_SET_FREQUENCY_HZ, &fHz, sizeof(fHz),
+		sizeof(fHz), fn, context);
+}
+
+
+API int fcd_get_frequency_Hz_async(FCD *dev, fcd_async_callback *fn,
+	void *context)
+{
+	return fcd_async_submit(dev, FCD_CMD_GET_FREQUENCY_HZ, NULL, 0, 4, fn,
+		context);
+}
+
+
+API int fcd_set_value_async(FCD *dev, FCD_VALUE_ENUM id,
+	unsigned char value, fcd_async_callback *fn, void *context)
+{
+	if (id >= FCD_VALUE_UNDEFINED)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	return fcd_async_submit(dev, FCD_CMD_SET_VALUE_OFFSET + id, &value, 1, 0,
+		fn, context);
+}
+
+
+API int fcd_get_value_async(FCD *dev, FCD_VALUE_ENUM id,
+	fcd_async_callback *fn, void *context)
+{
+	if (id >= FCD_VALUE_UNDEFINED)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	return fcd_async_submit(dev, FCD_CMD_GET_VALUE_OFFSET + id, NULL, 0, 1,
+		fn, context);
+}
+
+
+API int fcd_async_dispatch(int timeout_ms)
+{
+	fcd_async_request *request;
+	int count = 0;
+	int result = 0;
+
+	pthread_once(&completions_once, fcd_async_init);
+	pthread_mutex_lock(&completions.lock);
+	if (NULL == completions.queue.head && timeout_ms)
+	{
+		if (timeout_ms < 0)
+		{
+			while (NULL == completions.queue.head && !result)
+			{
+				result = pthread_cond_wait(&completions.cond,
+					&completions.lock);
+			}
+		}
+		else
+		{
+			struct timespec ts;
+			fcd_cond_deadline(&ts, (unsigned int) timeout_ms);
+			while (NULL == completions.queue.head && !result)
+			{
+				result = pthread_cond_timedwait(&completions.cond,
+					&completions.lock, &ts);
+			}
+		}
+	}
+	/* take everything that has finished */
+	request = completions.queue.head;
+	completions.queue.head = NULL;
+	completions.queue.tail = NULL;
+	pthread_mutex_unlock(&completions.lock);
+
+	if (result && ETIMEDOUT != result)
+	{
+		errno = result;
+		return -1;
+	}
+
+	/* run callbacks outside of the lock */
+	while (NULL != request)
+	{
+		fcd_async_request *next = request->next;
+		if (NULL != request->fn)
+		{
+			unsigned int value = 0;
+			if (4 == request->olen)
+			{
+				uint32_t word;
+				memcpy(&word, request->odata, sizeof(word));
+				value = convert_le_u32(word);
+			}
+			else if (request->olen)
+			{
+				value = request->odata[0];
+			}
+			request->fn(request->dev, request->status, value,
+				request->context);
+		}
+		free(request);
+		request = next;
+		++count;
+	}
+
+	return count;
+}
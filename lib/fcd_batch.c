@@ -0,0 +1,384 @@
+/*! \file
+ * \brief FUNcube dongle command batch implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <stdlib.h> /* NULL, malloc, realloc, free */
+#include <string.h> /* memcpy, memset */
+#include "fcd.h" /* FCD, FCD_BATCH, fcd_front_end */
+#include "fcd_cmd.h" /* FCD_CMD_* */
+#include "fcd_common.h"
+
+
+/*
+ * Types
+ */
+
+
+/*! \brief Queued batch command */
+typedef struct
+{
+	/*! \brief Command ID */
+	unsigned char cmd;
+	/*! \brief Input data length */
+	unsigned char ilen;
+	/*! \brief Output data length */
+	unsigned char olen;
+	/*! \brief Input data (little-endian) */
+	unsigned char data[4];
+} fcd_batch_entry;
+
+/*! \brief Implementation of \ref FCD_BATCH */
+struct FCD_batch_impl
+{
+	/*! \brief Queued commands */
+	fcd_batch_entry *entries;
+	/*! \brief Number of queued commands */
+	unsigned int count;
+	/*! \brief Allocated number of entries */
+	unsigned int capacity;
+};
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Queue a command
+ * \param[in,out] batch \ref FCD_BATCH
+ * \param         cmd   command ID
+ * \param[in]     idata input data pointer
+ * \param         ilen  input data length (at most 4)
+ * \param         olen  output data length (at most 4)
+ * \retval >=0 index of command
+ * \retval -1  failure
+ */
+static int fcd_batch_add(FCD_BATCH *batch, unsigned char cmd,
+	const void *idata, unsigned char ilen, unsigned char olen)
+{
+	fcd_batch_entry *entry;
+
+	if (NULL == batch)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (batch->count == batch->capacity)
+	{
+		/* grow geometrically */
+		unsigned int capacity = batch->capacity ? 2 * batch->capacity : 16;
+		fcd_batch_entry *entries;
+		entries = realloc(batch->entries, capacity * sizeof(*entries));
+		if (NULL == entries)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		batch->entries = entries;
+		batch->capacity = capacity;
+	}
+
+	entry = &batch->entries[batch->count];
+	entry->cmd = cmd;
+	entry->ilen = ilen;
+	entry->olen = olen;
+	if (ilen)
+	{
+		memcpy(entry->data, idata, ilen);
+	}
+
+	return batch->count++;
+}
+
+
+API FCD_BATCH * fcd_batch_new(void)
+{
+	FCD_BATCH *batch;
+
+	batch = malloc(sizeof(FCD_BATCH));
+	if (NULL != batch)
+	{
+		batch->entries = NULL;
+		batch->count = 0;
+		batch->capacity = 0;
+	}
+
+	return batch;
+}
+
+
+API void fcd_batch_free(FCD_BATCH *batch)
+{
+	if (NULL != batch)
+	{
+		free(batch->entries);
+		free(batch);
+	}
+}
+
+
+API void fcd_batch_clear(FCD_BATCH *batch)
+{
+	if (NULL != batch)
+	{
+		batch->count = 0;
+	}
+}
+
+
+API unsigned int fcd_batch_size(const FCD_BATCH *batch)
+{
+	return (NULL != batch) ? batch->count : 0;
+}
+
+
+API int fcd_batch_set_value(FCD_BATCH *batch, FCD_VALUE_ENUM id,
+	unsigned char value)
+{
+	if (id >= FCD_VALUE_UNDEFINED)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	return fcd_batch_add(batch, FCD_CMD_SET_VALUE_OFFSET + id, &value, 1, 0);
+}
+
+
+API int fcd_batch_get_value(FCD_BATCH *batch, FCD_VALUE_ENUM id)
+{
+	if (id >= FCD_VALUE_UNDEFINED)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	return fcd_batch_add(batch, FCD_CMD_GET_VALUE_OFFSET + id, NULL, 0, 1);
+}
+
+
+API int fcd_batch_set_frequency_Hz(FCD_BATCH *batch, unsigned int freq)
+{
+	uint32_t fHz = convert_le_u32(freq);
+	return fcd_batch_add(batch, FCD_CMD_SET_FREQUENCY_HZ, &fHz, sizeof(fHz),
+		sizeof(fHz));
+}
+
+
+API int fcd_batch_set_frequency_Hz_planned(FCD_BATCH *batch,
+	unsigned int freq)
+{
+	fcd_front_end plan;
+	unsigned int count;
+	int index;
+
+	if (NULL == batch)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	fcd_plan_front_end(freq, &plan);
+
+	/* frequency first: the device picks its own band and RF filter */
+	count = batch->count;
+	index = fcd_batch_set_frequency_Hz(batch, freq);
+	if (index < 0 ||
+		fcd_batch_set_value(batch, FCD_VALUE_BAND, plan.band) < 0 ||
+		fcd_batch_set_value(batch, FCD_VALUE_RF_FILTER, plan.rf_filter) < 0 ||
+		fcd_batch_set_value(batch, FCD_VALUE_BIAS_CURRENT,
+			plan.bias_current) < 0)
+	{
+		/* all or nothing */
+		batch->count = count;
+		return -1;
+	}
+
+	return index;
+}
+
+
+API int fcd_batch_get_frequency_Hz(FCD_BATCH *batch)
+{
+	return fcd_batch_add(batch, FCD_CMD_GET_FREQUENCY_HZ, NULL, 0, 4);
+}
+
+
+API int fcd_batch_set_dc_correction(FCD_BATCH *batch, int i, int q)
+{
+	int16_t correction[2];
+
+	correction[0] = i;
+	correction[1] = q;
+	if ((i != correction[0]) || (q != correction[1]))
+	{
+		/* value out of range */
+		errno = EOVERFLOW;
+		return -1;
+	}
+	correction[0] = (int16_t) convert_le_u16((uint16_t) correction[0]);
+	correction[1] = (int16_t) convert_le_u16((uint16_t) correction[1]);
+
+	return fcd_batch_add(batch, FCD_CMD_SET_DC_CORR, correction,
+		sizeof(correction), 0);
+}
+
+
+API int fcd_batch_get_dc_correction(FCD_BATCH *batch)
+{
+	return fcd_batch_add(batch, FCD_CMD_GET_DC_CORR, NULL, 0, 4);
+}
+
+
+API int fcd_batch_set_iq_correction(FCD_BATCH *batch, int phase,
+	unsigned int gain)
+{
+	struct {
+		int16_t phase;
+		uint16_t gain;
+	} correction;
+
+	correction.phase = phase;
+	correction.gain = gain;
+	if ((phase != correction.phase) || (gain != correction.gain))
+	{
+		/* value out of range */
+		errno = EOVERFLOW;
+		return -1;
+	}
+	correction.phase = (int16_t) convert_le_u16((uint16_t) correction.phase);
+	correction.gain = convert_le_u16(correction.gain);
+
+	return fcd_batch_add(batch, FCD_CMD_SET_IQ_CORR, &correction,
+		sizeof(correction), 0);
+}
+
+
+API int fcd_batch_get_iq_correction(FCD_BATCH *batch)
+{
+	return fcd_batch_add(batch, FCD_CMD_GET_IQ_CORR, NULL, 0, 4);
+}
+
+
+/*!
+ * \brief Decode the output of a batch command
+ * \param[in]  entry  command
+ * \param[in]  data   raw output data
+ * \param[out] result result
+ */
+static void fcd_batch_decode(const fcd_batch_entry *entry,
+	const unsigned char *data, fcd_batch_result *result)
+{
+	uint16_t half[2];
+	uint32_t word;
+
+	result->value = 0;
+	result->value2 = 0;
+	switch (entry->cmd)
+	{
+		case FCD_CMD_SET_FREQUENCY_HZ:
+		case FCD_CMD_GET_FREQUENCY_HZ:
+			memcpy(&word, data, sizeof(word));
+			result->value = convert_le_u32(word);
+			break;
+		case FCD_CMD_GET_DC_CORR:
+			memcpy(half, data, sizeof(half));
+			result->value = (int16_t) convert_le_u16(half[0]);
+			result->value2 = (int16_t) convert_le_u16(half[1]);
+			break;
+		case FCD_CMD_GET_IQ_CORR:
+			memcpy(half, data, sizeof(half));
+			result->value = (int16_t) convert_le_u16(half[0]);
+			result->value2 = convert_le_u16(half[1]);
+			break;
+		default:
+			if (entry->olen)
+			{
+				/* 1-byte value */
+				result->value = data[0];
+			}
+			break;
+	}
+}
+
+
+API int fcd_batch_run(FCD *dev, const FCD_BATCH *batch,
+	fcd_batch_result *results)
+{
+	fcd_io_op *ops;
+	unsigned char (*outputs)[4];
+	unsigned int index;
+	int result;
+
+	if (NULL == batch)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (!batch->count)
+	{
+		return 0;
+	}
+
+	/* one allocation for the commands and their output buffers */
+	ops = malloc(batch->count * (sizeof(*ops) + sizeof(*outputs)));
+	if (NULL == ops)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	outputs = (unsigned char (*)[4]) (ops + batch->count);
+	memset(outputs, 0, batch->count * sizeof(*outputs));
+
+	for (index = 0; index < batch->count; ++index)
+	{
+		const fcd_batch_entry *entry = &batch->entries[index];
+		ops[index].cmd = entry->cmd;
+		ops[index].iskip = 0;
+		ops[index].idata = entry->data;
+		ops[index].ilen = entry->ilen;
+		ops[index].odata = outputs[index];
+		ops[index].olen = entry->olen;
+	}
+
+	result = fcd_io_pipeline(dev, ops, batch->count);
+
+	if (NULL != results)
+	{
+		for (index = 0; index < batch->count; ++index)
+		{
+			results[index].status = ops[index].status;
+			if (ops[index].status)
+			{
+				/* failed or never sent: there is no output to decode */
+				results[index].value = 0;
+				results[index].value2 = 0;
+				continue;
+			}
+			fcd_batch_decode(&batch->entries[index], outputs[index],
+				&results[index]);
+		}
+	}
+
+	free(ops);
+	return result;
+}
@@ -22,13 +22,215 @@
 # include <config.h>
 #endif
 
-#include <stdlib.h> /* NULL */
-#include <string.h> /* memcmp */
+#include <errno.h> /* E*, errno */
+#include <stdlib.h> /* NULL, malloc, free */
+#include <string.h> /* memcmp, memset */
 #include "fcd.h" /* FCD */
 #include "fcd_cmd.h" /* FCD_CMD_* */
 #include "fcd_common.h"
 
 
+/*
+ * Defines
+ */
+
+/*! \brief Number of blocks read back per pipelined chunk */
+#define FCD_BL_SCAN_BLOCKS 32
+
+/*! \brief Number of blocks written, then read back, per window */
+#define FCD_BL_WINDOW_BLOCKS 32
+
+/*! \brief Attempts at writing a window before giving up */
+#define FCD_BL_WINDOW_TRIES 3
+
+
+/*
+ * Constants
+ */
+
+
+/*! \brief CRC-32 (IEEE 802.3, reflected) of each 4-bit value */
+static const uint32_t fcd_bl_crc32_nibble[16] =
+{
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Update CRC-32 (as zlib crc32())
+ * \param     crc  CRC-32 so far (0 to start)
+ * \param[in] data data
+ * \param     len  length of \p data
+ * \returns CRC-32 of everything so far and \p data
+ */
+static uint32_t fcd_bl_crc32(uint32_t crc, const unsigned char *data,
+	unsigned int len)
+{
+	crc ^= 0xffffffff;
+	while (len--)
+	{
+		crc ^= *data++;
+		crc = (crc >> 4) ^ fcd_bl_crc32_nibble[crc & 0x0f];
+		crc = (crc >> 4) ^ fcd_bl_crc32_nibble[crc & 0x0f];
+	}
+	return crc ^ 0xffffffff;
+}
+
+
+/*!
+ * \brief Get and check the flash range against a flash image
+ * \param[in,out] dev   open \ref FCD
+ * \param         size  size of flash image (0 to skip the check)
+ * \param[out]    start start of flash range
+ * \param[out]    end   end of flash range
+ * \retval 0     success
+ * \retval non-0 failure (as fcd_bl_flash_write())
+ */
+static int fcd_bl_flash_range(FCD *dev, unsigned int size,
+	unsigned int *start, unsigned int *end)
+{
+	/* get flash range */
+	if (fcd_bl_get_address_range(dev, start, end))
+	{
+		return -1;
+	}
+	/* sanity check range */
+	if (*start >= *end || (*end - *start) % 48)
+	{
+		return -2;
+	}
+	/* ensure firmware image is large enough */
+	if (size && *end > size)
+	{
+		return -3;
+	}
+	return 0;
+}
+
+
+/*!
+ * \brief Stream the flash range back, comparing it with an image
+ * \param[in,out] dev    open \ref FCD (transaction held, pinned)
+ * \param[in]     data   flash image data (or \c NULL for digest only)
+ * \param         size   size of \p data
+ * \param[out]    report digests and blocks that differ
+ * \param         map    non-zero to mark differing blocks in the bitmap
+ * \retval 0     success
+ * \retval non-0 failure (as fcd_bl_flash_verify())
+ */
+static int fcd_bl_flash_scan(FCD *dev, const unsigned char *data,
+	unsigned int size, fcd_verify_report *report, int map)
+{
+	fcd_io_op ops[FCD_BL_SCAN_BLOCKS];
+	unsigned char buffer[FCD_BL_SCAN_BLOCKS * 48];
+	unsigned int start, end, block, index, count;
+	int result;
+
+	result = fcd_bl_flash_range(dev, (NULL != data) ? size : 0, &start, &end);
+	if (result)
+	{
+		return result;
+	}
+	if (map && (end - start) / 48 > FCD_VERIFY_MAX_BLOCKS)
+	{
+		/* more blocks than the bitmap holds */
+		return -2;
+	}
+	memset(report, 0, sizeof(*report));
+	report->start = start;
+	report->blocks = (end - start) / 48;
+
+	/* set address to start of flash */
+	if (fcd_bl_set_address(dev, start))
+	{
+		return -4;
+	}
+	/* the device advances the address with each block, in order */
+	for (block = 0; block < report->blocks; block += count)
+	{
+		const unsigned char *image = (NULL != data) ?
+			data + start + 48 * block : NULL;
+
+		count = report->blocks - block;
+		if (count > FCD_BL_SCAN_BLOCKS)
+		{
+			count = FCD_BL_SCAN_BLOCKS;
+		}
+		memset(ops, 0, count * sizeof(ops[0]));
+		for (index = 0; index < count; ++index)
+		{
+			ops[index].cmd = FCD_CMD_READ_BLOCK;
+			ops[index].odata = buffer + 48 * index;
+			ops[index].olen = 48;
+		}
+		if (fcd_io_pipeline(dev, ops, count))
+		{
+			return -6;
+		}
+
+		/* fold this chunk in while it is still in cache */
+		report->flash_crc = fcd_bl_crc32(report->flash_crc, buffer,
+			48 * count);
+		if (NULL == image)
+		{
+			continue;
+		}
+		report->image_crc = fcd_bl_crc32(report->image_crc, image,
+			48 * count);
+		for (index = 0; index < count; ++index)
+		{
+			if (!memcmp(buffer + 48 * index, image + 48 * index, 48))
+			{
+				continue;
+			}
+			if (map)
+			{
+				report->bitmap[(block + index) / 8] |=
+					1 << ((block + index) % 8);
+			}
+			++report->mismatches;
+		}
+	}
+	return 0;
+}
+
+
+/*!
+ * \brief Stream the flash range back as one transaction on a held handle
+ * \copydetails fcd_bl_flash_scan
+ */
+static int fcd_bl_flash_scan_pinned(FCD *dev, const unsigned char *data,
+	unsigned int size, fcd_verify_report *report, int map)
+{
+	int pinned, result;
+
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	pinned = fcd_pin(dev);
+	if (pinned < 0)
+	{
+		fcd_unlock(dev);
+		return -1;
+	}
+
+	result = fcd_bl_flash_scan(dev, data, size, report, map);
+
+	fcd_unpin(dev, pinned);
+	fcd_unlock(dev);
+	return result;
+}
+
+
 API int fcd_bl_erase_application(FCD *dev)
 {
 	return fcd_set(dev, FCD_CMD_ERASE_APPLICATION, NULL, 0);
@@ -123,6 +325,203 @@ API int fcd_bl_flash_write(FCD *dev, const unsigned char *data,
 }
 
 
+/*!
+ * \brief Write all blocks of a flash image with several in flight
+ * \param[in,out] dev          open \ref FCD (transaction held, pinned)
+ * \param[in]     data         flash image data
+ * \param         size         size of \p data
+ * \param[out]    blocks_per_s write rate achieved (or \c NULL)
+ * \retval 0     success
+ * \retval non-0 failure (as fcd_bl_flash_write())
+ */
+static int fcd_bl_flash_pipeline(FCD *dev, const unsigned char *data,
+	unsigned int size, double *blocks_per_s)
+{
+	unsigned int start, end, index, count;
+	fcd_io_op *ops;
+	double begin, elapsed;
+	int result;
+
+	result = fcd_bl_flash_range(dev, size, &start, &end);
+	if (result)
+	{
+		return result;
+	}
+	count = (end - start) / 48;
+	ops = malloc(count * sizeof(*ops));
+	if (NULL == ops)
+	{
+		errno = ENOMEM;
+		return -5;
+	}
+	memset(ops, 0, count * sizeof(*ops));
+	for (index = 0; index < count; ++index)
+	{
+		/* 1 byte skip, as for fcd_bl_write_block() */
+		ops[index].cmd = FCD_CMD_WRITE_BLOCK;
+		ops[index].iskip = 1;
+		ops[index].idata = data + start + 48 * index;
+		ops[index].ilen = 48;
+	}
+
+	/* set address to start of flash */
+	if (fcd_bl_set_address(dev, start))
+	{
+		free(ops);
+		return -4;
+	}
+	/* the device advances the address with each block, in order */
+	begin = us_now() / 1e6;
+	result = fcd_io_pipeline(dev, ops, count) ? -5 : 0;
+	elapsed = us_now() / 1e6 - begin;
+	if (!result && NULL != blocks_per_s)
+	{
+		*blocks_per_s = (elapsed > 0) ? count / elapsed : 0;
+	}
+
+	free(ops);
+	return result;
+}
+
+
+API int fcd_bl_flash_write_pipelined(FCD *dev, const unsigned char *data,
+	unsigned int size, double *blocks_per_s)
+{
+	int pinned, result;
+
+	if (NULL == dev || NULL == data)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	/* one handle, held open, for the whole image */
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	pinned = fcd_pin(dev);
+	if (pinned < 0)
+	{
+		fcd_unlock(dev);
+		return -1;
+	}
+
+	result = fcd_bl_flash_pipeline(dev, data, size, blocks_per_s);
+
+	fcd_unpin(dev, pinned);
+	fcd_unlock(dev);
+	return result;
+}
+
+
+/*!
+ * \brief Write a window of blocks and read it straight back
+ * \param[in,out] dev    open \ref FCD (transaction held, pinned)
+ * \param         addr   address of first block
+ * \param[in]     data   image data for the window
+ * \param         count  number of blocks (up to \ref FCD_BL_WINDOW_BLOCKS)
+ * \param[out]    buffer flash contents read back (\p count blocks)
+ * \retval 0     success
+ * \retval non-0 failure (as fcd_bl_flash_write())
+ * \note Leaves the device address at the end of the window.
+ */
+static int fcd_bl_flash_window(FCD *dev, unsigned int addr,
+	const unsigned char *data, unsigned int count, unsigned char *buffer)
+{
+	fcd_io_op ops[2 * FCD_BL_WINDOW_BLOCKS + 2];
+	uint32_t address;
+	unsigned int index;
+
+	/* seek, write, seek back, and read back, all in one pipeline */
+	address = convert_le_u32(addr);
+	memset(ops, 0, (2 * count + 2) * sizeof(ops[0]));
+	ops[0].cmd = FCD_CMD_SET_BYTE_ADDR;
+	ops[0].idata = &address;
+	ops[0].ilen = sizeof(address);
+	ops[count + 1] = ops[0];
+	for (index = 0; index < count; ++index)
+	{
+		/* 1 byte skip, as for fcd_bl_write_block() */
+		ops[1 + index].cmd = FCD_CMD_WRITE_BLOCK;
+		ops[1 + index].iskip = 1;
+		ops[1 + index].idata = data + 48 * index;
+		ops[1 + index].ilen = 48;
+		ops[count + 2 + index].cmd = FCD_CMD_READ_BLOCK;
+		ops[count + 2 + index].odata = buffer + 48 * index;
+		ops[count + 2 + index].olen = 48;
+	}
+	if (fcd_io_pipeline(dev, ops, 2 * count + 2))
+	{
+		return ops[0].status ? -4 : -5;
+	}
+	return 0;
+}
+
+
+API int fcd_bl_flash_write_verified(FCD *dev, const unsigned char *data,
+	unsigned int size, unsigned int *rewrites)
+{
+	unsigned char buffer[FCD_BL_WINDOW_BLOCKS * 48];
+	unsigned int start, end, addr, count, tries;
+	int pinned, result;
+
+	if (NULL == dev || NULL == data)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (NULL != rewrites)
+	{
+		*rewrites = 0;
+	}
+	/* one handle, held open, for the whole image */
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	pinned = fcd_pin(dev);
+	if (pinned < 0)
+	{
+		fcd_unlock(dev);
+		return -1;
+	}
+
+	result = fcd_bl_flash_range(dev, size, &start, &end);
+	for (addr = start; !result && addr < end; addr += 48 * count)
+	{
+		count = (end - addr) / 48;
+		if (count > FCD_BL_WINDOW_BLOCKS)
+		{
+			count = FCD_BL_WINDOW_BLOCKS;
+		}
+		for (tries = 0; ; ++tries)
+		{
+			result = fcd_bl_flash_window(dev, addr, data + addr, count,
+				buffer);
+			if (result || !memcmp(buffer, data + addr, 48 * count))
+			{
+				break;
+			}
+			if (tries + 1 >= FCD_BL_WINDOW_TRIES)
+			{
+				/* still wrong after rewriting */
+				result = -6;
+				break;
+			}
+			/* rewrite just this window */
+			if (NULL != rewrites)
+			{
+				++*rewrites;
+			}
+		}
+	}
+
+	fcd_unpin(dev, pinned);
+	fcd_unlock(dev);
+	return result;
+}
+
+
 API int fcd_bl_flash_verify(FCD *dev, const unsigned char *data,
 	unsigned int size)
 {
@@ -163,3 +562,61 @@ API int fcd_bl_flash_verify(FCD *dev, const unsigned char *data,
 	return 0;
 }
 
+
+API int fcd_bl_flash_crc32(FCD *dev, unsigned int *crc)
+{
+	fcd_verify_report report;
+	int result;
+
+	if (NULL == dev || NULL == crc)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	result = fcd_bl_flash_scan_pinned(dev, NULL, 0, &report, 0);
+	if (!result)
+	{
+		*crc = report.flash_crc;
+	}
+	return result;
+}
+
+
+API int fcd_bl_flash_is_current(FCD *dev, const unsigned char *data,
+	unsigned int size)
+{
+	fcd_verify_report report;
+	int result;
+
+	if (NULL == dev || NULL == data)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	result = fcd_bl_flash_scan_pinned(dev, data, size, &report, 0);
+	if (!result)
+	{
+		/* compare blocks, not digests: a CRC collision must not match */
+		result = (0 == report.mismatches);
+	}
+	return result;
+}
+
+
+API int fcd_bl_flash_verify_report(FCD *dev, const unsigned char *data,
+	unsigned int size, fcd_verify_report *report)
+{
+	int result;
+
+	if (NULL == dev || NULL == data || NULL == report)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	result = fcd_bl_flash_scan_pinned(dev, data, size, report, 1);
+	if (!result && report->mismatches)
+	{
+		result = 1;
+	}
+	return result;
+}
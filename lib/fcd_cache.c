@@ -0,0 +1,250 @@
+/*! \file
+ * \brief FUNcube dongle tuner state shadow implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <stdlib.h> /* NULL */
+#include <string.h> /* memcmp, memcpy, memset */
+#include "fcd.h" /* FCD, fcd_invalidate */
+#include "fcd_cmd.h" /* FCD_CMD_* */
+#include "fcd_common.h"
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Find the shadow of the setting a command sets or gets
+ * \param[in,out] shadow shadow of tuner state
+ * \param         cmd    command ID
+ * \param[out]    set    non-zero if \p cmd is a set
+ * \param[out]    len    setting length (in bytes)
+ * \retval non-NULL shadow entry
+ * \retval NULL     \p cmd does not set or get a shadowed setting
+ */
+static fcd_shadow_entry * fcd_cache_entry(fcd_shadow *shadow, unsigned char cmd,
+	int *set, unsigned char *len)
+{
+	*set = 0;
+	*len = 4;
+	switch (cmd)
+	{
+		case FCD_CMD_SET_FREQUENCY_HZ:
+			*set = 1;
+			return &shadow->frequency;
+		case FCD_CMD_GET_FREQUENCY_HZ:
+			return &shadow->frequency_actual;
+		case FCD_CMD_SET_DC_CORR:
+			*set = 1;
+			/* fall through */
+		case FCD_CMD_GET_DC_CORR:
+			return &shadow->dc;
+		case FCD_CMD_SET_IQ_CORR:
+			*set = 1;
+			/* fall through */
+		case FCD_CMD_GET_IQ_CORR:
+			return &shadow->iq;
+		default:
+			break;
+	}
+
+	*len = 1;
+	if (cmd >= FCD_CMD_SET_VALUE_OFFSET &&
+		cmd < FCD_CMD_SET_VALUE_OFFSET + FCD_VALUE_UNDEFINED)
+	{
+		*set = 1;
+		return &shadow->value[cmd - FCD_CMD_SET_VALUE_OFFSET];
+	}
+	if (cmd >= FCD_CMD_GET_VALUE_OFFSET &&
+		cmd < FCD_CMD_GET_VALUE_OFFSET + FCD_VALUE_UNDEFINED)
+	{
+		return &shadow->value[cmd - FCD_CMD_GET_VALUE_OFFSET];
+	}
+
+	return NULL;
+}
+
+
+/*!
+ * \brief Check whether the shadow of tuner state is in use
+ * \param[in] dev open \ref FCD
+ * \retval non-0 in use
+ * \retval 0     not in use
+ */
+static int fcd_cache_enabled(const FCD *dev)
+{
+	return !(dev->flags & (FCD_OPEN_NO_CACHE | FCD_OPEN_TRANSIENT));
+}
+
+
+int fcd_cache_lookup(FCD *dev, fcd_io_op *op)
+{
+	fcd_shadow_entry *entry;
+	unsigned char len;
+	int set;
+
+	if (!fcd_cache_enabled(dev) || op->iskip)
+	{
+		return 0;
+	}
+	entry = fcd_cache_entry(&dev->shadow, op->cmd, &set, &len);
+	if (NULL == entry || !entry->valid)
+	{
+		return 0;
+	}
+
+	if (set)
+	{
+		/* skip sets that would not change anything */
+		if (len != op->ilen || NULL == op->idata ||
+			memcmp(entry->data, op->idata, len))
+		{
+			return 0;
+		}
+		if (FCD_CMD_SET_FREQUENCY_HZ == op->cmd && op->olen)
+		{
+			/* report the frequency the device tuned to last time */
+			if (!dev->shadow.frequency_actual.valid || op->olen > 4 ||
+				NULL == op->odata)
+			{
+				return 0;
+			}
+			memcpy(op->odata, dev->shadow.frequency_actual.data, op->olen);
+			return 1;
+		}
+		return !op->olen;
+	}
+
+	/* serve gets */
+	if (op->ilen || op->olen > len || (op->olen && NULL == op->odata))
+	{
+		return 0;
+	}
+	memcpy(op->odata, entry->data, op->olen);
+	return 1;
+}
+
+
+void fcd_cache_sent(FCD *dev, const fcd_io_op *op)
+{
+	fcd_shadow_entry *entry;
+	unsigned char len;
+	int set;
+
+	if (!fcd_cache_enabled(dev))
+	{
+		return;
+	}
+	entry = fcd_cache_entry(&dev->shadow, op->cmd, &set, &len);
+	if (NULL != entry)
+	{
+		if (set)
+		{
+			/* unknown until the device confirms it */
+			entry->valid = 0;
+			if (FCD_CMD_SET_FREQUENCY_HZ == op->cmd)
+			{
+				/* the device may round the requested frequency, and
+				   picks band and RF filter to suit it */
+				dev->shadow.frequency_actual.valid = 0;
+				dev->shadow.value[FCD_VALUE_BAND].valid = 0;
+				dev->shadow.value[FCD_VALUE_RF_FILTER].valid = 0;
+			}
+		}
+		return;
+	}
+
+	switch (op->cmd)
+	{
+		case FCD_CMD_QUERY:
+		case FCD_CMD_GET_IF_RSSI:
+		case FCD_CMD_GET_PLL_LOCK:
+		case FCD_CMD_SET_BYTE_ADDR:
+		case FCD_CMD_GET_BYTE_ADDR_RANGE:
+		case FCD_CMD_READ_BLOCK:
+			/* does not change tuner state */
+			break;
+		default:
+			/* may change anything */
+			memset(&dev->shadow, 0, sizeof(dev->shadow));
+			break;
+	}
+}
+
+
+void fcd_cache_update(FCD *dev, const fcd_io_op *op)
+{
+	fcd_shadow_entry *entry;
+	unsigned char len;
+	int set;
+
+	if (!fcd_cache_enabled(dev) || op->cached)
+	{
+		return;
+	}
+	entry = fcd_cache_entry(&dev->shadow, op->cmd, &set, &len);
+	if (NULL == entry || op->status || op->iskip)
+	{
+		/* fcd_cache_sent() already forgot the setting on failure */
+		return;
+	}
+
+	if (set)
+	{
+		if (len == op->ilen)
+		{
+			memcpy(entry->data, op->idata, len);
+			entry->valid = 1;
+		}
+		if (FCD_CMD_SET_FREQUENCY_HZ == op->cmd && op->olen >= 4)
+		{
+			/* the device reported the frequency it tuned to */
+			memcpy(dev->shadow.frequency_actual.data, op->odata, 4);
+			dev->shadow.frequency_actual.valid = 1;
+		}
+	}
+	else if (len == op->olen)
+	{
+		memcpy(entry->data, op->odata, len);
+		entry->valid = 1;
+	}
+}
+
+
+API int fcd_invalidate(FCD *dev)
+{
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	memset(&dev->shadow, 0, sizeof(dev->shadow));
+	fcd_unlock(dev);
+	return 0;
+}
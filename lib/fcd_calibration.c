@@ -0,0 +1,632 @@
+/*! \file
+ * \brief FUNcube dongle gain calibration implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <stdio.h> /* FILE, f*, rename, remove, snprintf */
+#include <stdlib.h> /* NULL, malloc, free, getenv */
+#include <string.h> /* mem*, strcpy, strdup, strrchr */
+#ifdef HAVE_MMAP
+# ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h> /* mmap, munmap */
+# endif
+#endif
+#ifdef _WIN32
+# include <direct.h> /* _mkdir */
+#elif defined(HAVE_SYS_STAT_H)
+# include <sys/stat.h> /* mkdir */
+#endif
+#include "fcd.h" /* FCD, fcd_calibrate */
+#include "fcd_cmd.h" /* FCD_CMD_* */
+#include "fcd_common.h"
+
+
+/*
+ * Defines
+ */
+
+/*! \brief Number of bands calibrated (by \ref FCD_TUNER_BAND_ENUM) */
+#define FCD_CALIBRATION_BANDS 4
+
+/*! \brief Calibration file format version */
+#define FCD_CALIBRATION_VERSION 1
+
+/*! \brief Calibration file header size (in bytes) */
+#define FCD_CALIBRATION_HEADER 12
+
+/*! \brief Calibration file size (in bytes) */
+#define FCD_CALIBRATION_SIZE (FCD_CALIBRATION_HEADER + \
+	FCD_CALIBRATION_BANDS * FCD_GAIN_SETTINGS * 2)
+
+/*! \brief Maximum number of IF RSSI samples averaged per measurement */
+#define FCD_CALIBRATION_MAX_SAMPLES 64
+
+/*! \brief Time for IF RSSI to follow a gain change (in ms) */
+#define FCD_CALIBRATION_SETTLE_MS 20
+
+/*! \brief IF level at IF RSSI 0 (in 0.01 dBm) */
+#define FCD_RSSI_ZERO_CDBM (-3500)
+
+/*! \brief Directory separator in calibration file paths */
+#ifdef _WIN32
+# define FCD_PATH_SEPARATOR '\\'
+#else
+# define FCD_PATH_SEPARATOR '/'
+#endif
+
+/*! \brief Create a (per-user) directory (see fcd_calibration_write()) */
+#ifdef _WIN32
+# define FCD_MKDIR(dir) _mkdir(dir)
+#elif defined(HAVE_MKDIR)
+# define FCD_MKDIR(dir) mkdir((dir), 0700)
+#endif
+
+/*! \brief Highest IF RSSI on the documented scale (readings clip here) */
+#define FCD_RSSI_FULL_SCALE 70
+
+/*! \brief IF level change per IF RSSI step (in 0.01 dB, 25 dB over 70) */
+#define FCD_RSSI_STEP_CDB (2500.0 / 70.0)
+
+
+/*
+ * Constants
+ */
+
+
+/*!
+ * \brief Calibration file header
+ * \note The file is the header followed by the gain of each of the
+ * \ref FCD_GAIN_SETTINGS settings (in \ref fcd_gain_stages order) for each
+ * band, as signed 16-bit little-endian values in 0.01 dB. The header is the
+ * magic, then version, band count, and setting count as 16-bit
+ * little-endian values, then 2 bytes of padding.
+ */
+static const unsigned char fcd_calibration_magic[6] = {'F', 'C', 'D', 'C',
+	FCD_CALIBRATION_VERSION, 0};
+
+/*! \brief Tuning frequency used to calibrate each band (in Hz) */
+static const unsigned int fcd_calibration_freq[FCD_CALIBRATION_BANDS] =
+{
+	100000000, 300000000, 600000000, 1500000000
+};
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Build the calibration file path of a device
+ * \param[in,out] hid_dev open HID device
+ * \retval non-NULL path (free with free())
+ * \retval NULL     no serial number (or out of memory)
+ */
+static char * fcd_calibration_path(hid_device *hid_dev)
+{
+	const char *dir = getenv("LIBFCD_CALIBRATION_DIR");
+	const char *home = "";
+	wchar_t serial[64];
+	char name[256];
+	size_t index, start;
+
+	if (hid_get_serial_number_string(hid_dev, serial,
+		sizeof(serial) / sizeof(serial[0])) || !serial[0])
+	{
+		return NULL;
+	}
+	if (NULL == dir || !*dir)
+	{
+#ifdef _WIN32
+		home = getenv("LOCALAPPDATA");
+		dir = "\\libfcd";
+#else
+		home = getenv("HOME");
+		dir = "/.libfcd";
+#endif
+		if (NULL == home || !*home)
+		{
+			return NULL;
+		}
+	}
+
+	/* one file per serial number, made safe as a file name */
+	start = snprintf(name, sizeof(name), "%s%s%c", home, dir,
+		FCD_PATH_SEPARATOR);
+	if (start >= sizeof(name) - 5)
+	{
+		return NULL;
+	}
+	for (index = 0; serial[index] && start + index < sizeof(name) - 5;
+		++index)
+	{
+		wchar_t c = serial[index];
+		int safe = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+			(c >= 'a' && c <= 'z') || '-' == c || '.' == c;
+		name[start + index] = safe ? (char) c : '_';
+	}
+	strcpy(&name[start + index], ".cal");
+
+	return strdup(name);
+}
+
+
+/*!
+ * \brief Load a calibration file
+ * \param[in,out] file calibration file (\p path set, \p data not loaded)
+ * \note Leaves \p data \c NULL unless the file is present and valid.
+ */
+static void fcd_calibration_load(fcd_calibration_file *file)
+{
+	unsigned char header[FCD_CALIBRATION_HEADER];
+	uint16_t counts[2];
+	FILE *fp;
+
+	fp = fopen(file->path, "rb");
+	if (NULL == fp)
+	{
+		return;
+	}
+	/* check the header before mapping anything */
+	if (1 != fread(header, sizeof(header), 1, fp) ||
+		memcmp(header, fcd_calibration_magic, sizeof(fcd_calibration_magic)))
+	{
+		fclose(fp);
+		return;
+	}
+	memcpy(counts, &header[6], sizeof(counts));
+	if (FCD_CALIBRATION_BANDS != convert_le_u16(counts[0]) ||
+		FCD_GAIN_SETTINGS != convert_le_u16(counts[1]) ||
+		fseek(fp, 0, SEEK_END) || FCD_CALIBRATION_SIZE != ftell(fp))
+	{
+		fclose(fp);
+		return;
+	}
+
+#ifdef HAVE_MMAP
+	{
+		/* pages are only read in when a conversion needs them */
+		void *map = mmap(NULL, FCD_CALIBRATION_SIZE, PROT_READ, MAP_SHARED,
+			fileno(fp), 0);
+		if (MAP_FAILED != map)
+		{
+			file->data = map;
+			file->size = FCD_CALIBRATION_SIZE;
+		}
+	}
+#else
+	{
+		unsigned char *data = malloc(FCD_CALIBRATION_SIZE);
+		if (NULL != data)
+		{
+			rewind(fp);
+			if (1 == fread(data, FCD_CALIBRATION_SIZE, 1, fp))
+			{
+				file->data = data;
+				file->size = FCD_CALIBRATION_SIZE;
+			}
+			else
+			{
+				free(data);
+			}
+		}
+	}
+#endif
+	fclose(fp);
+}
+
+
+/*!
+ * \brief Find and load the calibration file of a device, on first use
+ * \param[in,out] dev open \ref FCD (transaction held)
+ * \note Not done by fcd_open(), so that opening stays cheap. Transient
+ * handles are never calibrated (conversions use nominal gains).
+ */
+static void fcd_calibration_attach(FCD *dev)
+{
+	int pinned;
+
+	if (dev->calibration.attached || (dev->flags & FCD_OPEN_TRANSIENT))
+	{
+		return;
+	}
+	pinned = fcd_pin(dev);
+	if (pinned < 0)
+	{
+		/* try again next time */
+		return;
+	}
+	dev->calibration.attached = 1;
+	dev->calibration.path = fcd_calibration_path(dev->hid);
+	if (NULL != dev->calibration.path)
+	{
+		fcd_calibration_load(&dev->calibration);
+	}
+	fcd_unpin(dev, pinned);
+}
+
+
+void fcd_calibration_detach(FCD *dev, int all)
+{
+	if (NULL != dev->calibration.data)
+	{
+#ifdef HAVE_MMAP
+		munmap((void *) dev->calibration.data, dev->calibration.size);
+#else
+		free((void *) dev->calibration.data);
+#endif
+		dev->calibration.data = NULL;
+		dev->calibration.size = 0;
+	}
+	if (all && NULL != dev->calibration.path)
+	{
+		free(dev->calibration.path);
+		dev->calibration.path = NULL;
+	}
+}
+
+
+/*!
+ * \brief Get the gain of a setting
+ * \param[in] dev     open \ref FCD (transaction held)
+ * \param     band    band (\ref FCD_TUNER_BAND_ENUM)
+ * \param     stage   gain stage index (into \ref fcd_gain_stages)
+ * \param     setting index into the gain stage settings
+ * \returns gain (in 0.01 dB, nominal if not calibrated)
+ */
+static int fcd_calibration_gain(const FCD *dev, unsigned int band,
+	unsigned int stage, unsigned int setting)
+{
+	const fcd_gain_stage *info = &fcd_gain_stages[stage];
+	uint16_t gain;
+
+	if (NULL == dev->calibration.data || band >= FCD_CALIBRATION_BANDS)
+	{
+		return info->nominal_cdB[setting];
+	}
+	memcpy(&gain, dev->calibration.data + FCD_CALIBRATION_HEADER +
+		2 * (band * FCD_GAIN_SETTINGS + info->offset + setting), sizeof(gain));
+	return (int16_t) convert_le_u16(gain);
+}
+
+
+/*!
+ * \brief Measure average IF RSSI
+ * \param[in,out] dev     open \ref FCD
+ * \param         samples number of samples to average
+ * \param[out]    rssi    average IF RSSI (0 if any sample was clipped at
+ *                        either end of the scale)
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int fcd_calibration_measure(FCD *dev, unsigned int samples,
+	double *rssi)
+{
+	fcd_io_op ops[FCD_CALIBRATION_MAX_SAMPLES];
+	unsigned char values[FCD_CALIBRATION_MAX_SAMPLES];
+	unsigned int index, sum = 0;
+
+	ms_sleep(FCD_CALIBRATION_SETTLE_MS);
+
+	/* all samples in flight together */
+	memset(ops, 0, samples * sizeof(ops[0]));
+	for (index = 0; index < samples; ++index)
+	{
+		ops[index].cmd = FCD_CMD_GET_IF_RSSI;
+		ops[index].odata = &values[index];
+		ops[index].olen = 1;
+	}
+	if (fcd_io_pipeline(dev, ops, samples))
+	{
+		return -1;
+	}
+	for (index = 0; index < samples; ++index)
+	{
+		if (!values[index] || values[index] >= FCD_RSSI_FULL_SCALE)
+		{
+			/* clipped: says nothing about the gain */
+			*rssi = 0;
+			return 0;
+		}
+		sum += values[index];
+	}
+	*rssi = (double) sum / samples;
+	return 0;
+}
+
+
+/*!
+ * \brief Measure the gain of every setting in every band
+ * \param[in,out] dev     open \ref FCD (transaction held)
+ * \param         samples number of IF RSSI samples to average
+ * \param[in]     ref     reference settings (the tuner state on entry)
+ * \param[out]    table   gains (as stored in the calibration file)
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int fcd_calibration_run(FCD *dev, unsigned int samples,
+	const fcd_state *ref, unsigned char *table)
+{
+	unsigned int band, stage, setting;
+
+	for (band = 0; band < FCD_CALIBRATION_BANDS; ++band)
+	{
+		double base;
+
+		if (fcd_set_frequency_Hz_planned(dev, fcd_calibration_freq[band]) ||
+			fcd_calibration_measure(dev, samples, &base))
+		{
+			return -1;
+		}
+		for (stage = 0; stage < FCD_GAIN_STAGES; ++stage)
+		{
+			const fcd_gain_stage *info = &fcd_gain_stages[stage];
+			int current = fcd_gain_find(info, ref->value[info->id]);
+
+			for (setting = 0; setting < info->count; ++setting)
+			{
+				double rssi = base;
+				long gain = info->nominal_cdB[setting];
+				unsigned char *out = table + 2 * (band * FCD_GAIN_SETTINGS +
+					info->offset + setting);
+
+				if (current >= 0 && (unsigned int) current != setting &&
+					(fcd_set_value(dev, info->id, info->settings[setting]) ||
+					fcd_calibration_measure(dev, samples, &rssi)))
+				{
+					return -1;
+				}
+				if (current >= 0 && rssi > 0 && base > 0)
+				{
+					/* the reference setting is assumed to be nominal */
+					gain = info->nominal_cdB[current] +
+						(long) ((rssi - base) * FCD_RSSI_STEP_CDB);
+				}
+				/* otherwise (IF RSSI clipped) keep the nominal gain */
+				out[0] = (unsigned char) (gain & 0xff);
+				out[1] = (unsigned char) ((gain >> 8) & 0xff);
+			}
+			if (current >= 0 &&
+				fcd_set_value(dev, info->id, ref->value[info->id]))
+			{
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/*!
+ * \brief Write a calibration file (replacing any previous one)
+ * \param[in] path  file path
+ * \param[in] table gains (as stored in the calibration file)
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int fcd_calibration_write(const char *path, const unsigned char *table)
+{
+	unsigned char header[FCD_CALIBRATION_HEADER];
+	char temp[260];
+	FILE *fp;
+	int result;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, fcd_calibration_magic, sizeof(fcd_calibration_magic));
+	header[6] = FCD_CALIBRATION_BANDS;
+	header[8] = FCD_GAIN_SETTINGS;
+
+#ifdef FCD_MKDIR
+	{
+		/* create the (per-user) directory if needed */
+		char dir[256];
+		char *slash;
+		snprintf(dir, sizeof(dir), "%s", path);
+		slash = strrchr(dir, FCD_PATH_SEPARATOR);
+		if (NULL != slash)
+		{
+			*slash = '\0';
+			if (FCD_MKDIR(dir) && EEXIST != errno)
+			{
+				return -1;
+			}
+		}
+	}
+#endif
+
+	/* write aside, then rename over: mapped readers keep the old file */
+	snprintf(temp, sizeof(temp), "%s.new", path);
+	fp = fopen(temp, "wb");
+	if (NULL == fp)
+	{
+		return -1;
+	}
+	result = (1 != fwrite(header, sizeof(header), 1, fp)) ||
+		(1 != fwrite(table, FCD_CALIBRATION_SIZE - sizeof(header), 1, fp));
+	result |= fclose(fp);
+	if (!result)
+	{
+		result = rename(temp, path);
+	}
+	if (result)
+	{
+		remove(temp);
+		return -1;
+	}
+	return 0;
+}
+
+
+API int fcd_calibrate(FCD *dev, unsigned int samples)
+{
+	unsigned char *table;
+	fcd_state ref;
+	int result = -1;
+
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (!samples || samples > FCD_CALIBRATION_MAX_SAMPLES)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	table = malloc(FCD_CALIBRATION_SIZE - FCD_CALIBRATION_HEADER);
+	if (NULL == table)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (fcd_lock(dev))
+	{
+		free(table);
+		return -1;
+	}
+	fcd_calibration_attach(dev);
+	if (NULL == dev->calibration.path)
+	{
+		/* nothing to key the file on (or a transient handle) */
+		errno = ENOTSUP;
+	}
+	else if (!fcd_get_state(dev, &ref))
+	{
+		result = fcd_calibration_run(dev, samples, &ref, table);
+		/* put everything back, even after a failure */
+		result |= fcd_set_state(dev, &ref);
+	}
+	if (!result)
+	{
+		result = fcd_calibration_write(dev->calibration.path, table);
+	}
+	if (!result)
+	{
+		fcd_calibration_detach(dev, 0);
+		fcd_calibration_load(&dev->calibration);
+	}
+	fcd_unlock(dev);
+
+	free(table);
+	return result;
+}
+
+
+API int fcd_is_calibrated(FCD *dev)
+{
+	int result;
+
+	if (NULL == dev || fcd_lock(dev))
+	{
+		return 0;
+	}
+	fcd_calibration_attach(dev);
+	result = (NULL != dev->calibration.data);
+	fcd_unlock(dev);
+
+	return result;
+}
+
+
+API int fcd_get_gain_dB(FCD *dev, double *dB)
+{
+	fcd_batch_result results[FCD_GAIN_STAGES + 1];
+	FCD_BATCH *batch;
+	unsigned int stage;
+	long total = 0;
+	int result = -1;
+
+	if (NULL == dev || NULL == dB)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	batch = fcd_batch_new();
+	if (NULL == batch)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (fcd_lock(dev))
+	{
+		fcd_batch_free(batch);
+		return -1;
+	}
+	fcd_calibration_attach(dev);
+	for (stage = 0; stage < FCD_GAIN_STAGES; ++stage)
+	{
+		if (fcd_batch_get_value(batch, fcd_gain_stages[stage].id) < 0)
+		{
+			goto done;
+		}
+	}
+	/* normally answered from the shadow of tuner state */
+	if (fcd_batch_get_value(batch, FCD_VALUE_BAND) < 0 ||
+		fcd_batch_run(dev, batch, results))
+	{
+		goto done;
+	}
+	for (stage = 0; stage < FCD_GAIN_STAGES; ++stage)
+	{
+		int setting = fcd_gain_find(&fcd_gain_stages[stage],
+			(unsigned char) results[stage].value);
+		if (setting < 0)
+		{
+			/* not a known setting */
+			errno = ERANGE;
+			goto done;
+		}
+		total += fcd_calibration_gain(dev,
+			(unsigned int) results[FCD_GAIN_STAGES].value, stage,
+			(unsigned int) setting);
+	}
+	*dB = total / 100.0;
+	result = 0;
+
+done:
+	fcd_unlock(dev);
+	fcd_batch_free(batch);
+	return result;
+}
+
+
+API int fcd_rssi_to_dBm(FCD *dev, unsigned char rssi, double *dBm)
+{
+	double gain;
+
+	if (NULL == dBm)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (fcd_get_gain_dB(dev, &gain))
+	{
+		return -1;
+	}
+
+	/* IF level, referred back to the antenna input */
+	*dBm = (FCD_RSSI_ZERO_CDBM + rssi * FCD_RSSI_STEP_CDB) / 100.0 - gain;
+	return 0;
+}
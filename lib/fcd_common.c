@@ -23,11 +23,26 @@
 #endif
 
 #include <errno.h> /* E*, errno */
-#include <stdlib.h> /* NULL, malloc, free */
+#include <pthread.h> /* pthread_mutex_*, pthread_cond*_* */
+#include <stdio.h> /* snprintf */
+#include <stdlib.h> /* NULL, malloc, free, getenv */
 #include <string.h> /* memset, memcpy, strdup */
-#ifdef HAVE_USLEEP
-# ifdef HAVE_UNISTD_H
-#  include <unistd.h> /* usleep */
+#include <time.h> /* clock_gettime, struct timespec */
+#ifdef HAVE_UNISTD_H
+# include <unistd.h> /* usleep, close */
+#endif
+#ifdef HAVE_FLOCK
+# ifdef HAVE_FCNTL_H
+#  include <fcntl.h> /* open, O_* */
+# endif
+# ifdef HAVE_SYS_FILE_H
+#  include <sys/file.h> /* flock, LOCK_* */
+# endif
+# ifndef O_NOFOLLOW
+#  define O_NOFOLLOW 0 /* links are followed */
+# endif
+# ifndef O_CLOEXEC
+#  define O_CLOEXEC 0 /* the lock file is inherited */
 # endif
 #endif
 #include "fcd.h" /* FCD */
@@ -51,79 +66,534 @@ void ms_sleep(unsigned int ms)
 }
 
 
-int fcd_io(FCD *dev, unsigned char cmd, unsigned char iskip, const void *idata,
-	unsigned char ilen, void *odata, unsigned char olen)
+int64_t ms_now(void)
+{
+	return us_now() / 1000;
+}
+
+
+int64_t us_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void fcd_cond_init(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+
+	/* deadlines are not moved by changes to the system time */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+
+void fcd_cond_deadline(struct timespec *ts, unsigned int ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L)
+	{
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+
+/*!
+ * \brief Open the cross-process lock file of a device
+ * \param[in] path device path
+ * \retval >=0 file descriptor
+ * \retval -1  error
+ */
+static int fcd_lock_open(const char *path)
+{
+#ifdef HAVE_FLOCK
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char name[256];
+	size_t index, start;
+
+	/* prefer the per-user runtime directory to the shared one */
+	if (NULL == dir || !*dir)
+	{
+		dir = getenv("TMPDIR");
+	}
+	if (NULL == dir || !*dir)
+	{
+		dir = "/tmp";
+	}
+	/* one file per device path, with the path made safe as a file name */
+	start = snprintf(name, sizeof(name), "%s/libfcd-", dir);
+	if (start >= sizeof(name) - 5)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	for (index = start; *path && index < sizeof(name) - 6; ++index, ++path)
+	{
+		char c = *path;
+		int safe = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+			(c >= 'a' && c <= 'z') || '-' == c || '.' == c;
+		name[index] = safe ? c : '_';
+	}
+	strcpy(&name[index], ".lock");
+
+	/* do not follow a link planted in a shared directory */
+	return open(name, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+#else
+	(void) path;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+int fcd_lock(FCD *dev)
+{
+	pthread_mutex_lock(&dev->lock);
+	if (0 == dev->lock_depth && dev->lock_fd >= 0)
+	{
+#ifdef HAVE_FLOCK
+		/* outermost transaction: exclude other processes too */
+		int result;
+		do
+		{
+			result = flock(dev->lock_fd, LOCK_EX);
+		} while (result && EINTR == errno);
+		if (result)
+		{
+			pthread_mutex_unlock(&dev->lock);
+			return -1;
+		}
+#endif
+	}
+	++dev->lock_depth;
+	return 0;
+}
+
+
+void fcd_unlock(FCD *dev)
+{
+	if (0 == --dev->lock_depth && dev->lock_fd >= 0)
+	{
+#ifdef HAVE_FLOCK
+		flock(dev->lock_fd, LOCK_UN);
+#endif
+	}
+	pthread_mutex_unlock(&dev->lock);
+}
+
+
+/*!
+ * \brief Get the time to wait for an I/O step
+ * \param timeout_ms per-step timeout (in ms, -1 for forever)
+ * \param deadline   ms_now() time of the overall deadline (or -1 for none)
+ * \returns time to wait (in ms, -1 for forever)
+ */
+static int fcd_io_wait_ms(int timeout_ms, int64_t deadline)
+{
+	if (deadline >= 0)
+	{
+		int64_t remaining = deadline - ms_now();
+		if (remaining < 0)
+		{
+			remaining = 0;
+		}
+		if (timeout_ms < 0 || remaining < timeout_ms)
+		{
+			timeout_ms = (int) remaining;
+		}
+	}
+	return timeout_ms;
+}
+
+
+/*!
+ * \brief Open the HID device of an \ref FCD in the requested transport mode
+ * \param[in,out] dev \ref FCD (\p path must be set)
+ * \retval non-NULL HID device
+ * \retval NULL     error
+ */
+static hid_device * fcd_hid_open(FCD *dev)
 {
 	hid_device *hid_dev;
+
+	hid_dev = hid_open_path(dev->path);
+	if (NULL != hid_dev && (dev->flags & FCD_OPEN_DIRECT))
+	{
+		if (hid_set_direct_read(hid_dev, 1))
+		{
+			/* not supported: fall back to background reads */
+			dev->flags &= ~FCD_OPEN_DIRECT;
+		}
+	}
+	return hid_dev;
+}
+
+
+/*!
+ * \brief Get a HID device for a command
+ * \param[in,out] dev open \ref FCD
+ * \retval non-NULL HID device (release with fcd_hid_release())
+ * \retval NULL     error
+ */
+static hid_device * fcd_hid_acquire(FCD *dev)
+{
+	if (NULL != dev->hid)
+	{
+		/* use persistent device */
+		return dev->hid;
+	}
+	/*! \note Only serialized with other processes with \ref FCD_OPEN_LOCK */
+	return fcd_hid_open(dev);
+}
+
+
+/*!
+ * \brief Close a HID device, keeping count of the input reports it dropped
+ * \param[in,out] dev     open \ref FCD
+ * \param[in,out] hid_dev HID device
+ */
+static void fcd_hid_close(FCD *dev, hid_device *hid_dev)
+{
+	dev->input_overflow += hid_get_input_overflow(hid_dev);
+	hid_close(hid_dev);
+}
+
+
+/*!
+ * \brief Release a HID device acquired by fcd_hid_acquire()
+ * \param[in,out] dev     open \ref FCD
+ * \param[in,out] hid_dev HID device
+ */
+static void fcd_hid_release(FCD *dev, hid_device *hid_dev)
+{
+	if (hid_dev != dev->hid)
+	{
+		/* close transient device */
+		fcd_hid_close(dev, hid_dev);
+	}
+}
+
+
+/*!
+ * \brief Discard late responses queued for a HID device
+ * \param[in,out] hid_dev HID device
+ * \note A late response that matches a repeated command would otherwise be
+ * taken as its answer.
+ */
+static void fcd_hid_drain(hid_device *hid_dev)
+{
 	fcd_buffer buffer;
-	int result = -1;
 
-	/*! \todo validate cmd */
-	/* do not allow NULL pointer for device */
-	if (NULL == dev)
+	while (hid_read_timeout(hid_dev, (unsigned char *)&buffer,
+		sizeof(buffer.response), FCD_DRAIN_TIMEOUT_MS) > 0)
 	{
-		errno = EFAULT;
+		/* discard */
+	}
+}
+
+
+int fcd_pin(FCD *dev)
+{
+	if (NULL != dev->hid)
+	{
+		return 0;
+	}
+	dev->hid = fcd_hid_open(dev);
+	if (NULL == dev->hid)
+	{
+		errno = ENODEV;
 		return -1;
 	}
+	return 1;
+}
+
+
+void fcd_unpin(FCD *dev, int pinned)
+{
+	if (pinned > 0 && NULL != dev->hid)
+	{
+		fcd_hid_close(dev, dev->hid);
+		dev->hid = NULL;
+	}
+}
+
+
+/*!
+ * \brief Validate and send a command
+ * \param[in,out] hid_dev    HID device
+ * \param[in,out] op         command (lengths are trimmed as needed)
+ * \param         timeout_ms send timeout (in ms, -1 for forever)
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int fcd_io_send(hid_device *hid_dev, fcd_io_op *op, int timeout_ms)
+{
+	fcd_buffer buffer;
+
+	/*! \todo validate cmd */
 	/* do not allow NULL pointer for non-trivial I/O */
-	if ((ilen && (NULL == idata)) || (olen && (NULL == odata)))
+	if ((op->ilen && (NULL == op->idata)) || (op->olen && (NULL == op->odata)))
 	{
 		errno = EFAULT;
 		return -1;
 	}
 	/* trim request lengths as needed */
-	if (ilen > sizeof(buffer.command.data) - iskip)
+	if (op->iskip > sizeof(buffer.command.data))
 	{
-		ilen = sizeof(buffer.command.data) - iskip;
+		op->iskip = sizeof(buffer.command.data);
 	}
-	if (olen > sizeof(buffer.response.data))
+	if (op->ilen > sizeof(buffer.command.data) - op->iskip)
 	{
-		olen = sizeof(buffer.response.data);
+		op->ilen = sizeof(buffer.command.data) - op->iskip;
 	}
-
-	/*! \bug Linux: simultaneously open devices are not entirely process safe */
-	hid_dev = hid_open_path(dev->path);
-	if (NULL == hid_dev)
+	if (op->olen > sizeof(buffer.response.data))
 	{
-		errno = ENODEV;
-		return -1;
+		op->olen = sizeof(buffer.response.data);
 	}
 
 	/* send request */
 	buffer.command.report_id = 0;
-	buffer.command.command = cmd;
+	buffer.command.command = op->cmd;
 	/* pad skipped input byte(s) */
-	memset(&buffer.command.data, 0, iskip);
+	memset(&buffer.command.data, 0, op->iskip);
 	/* copy in data */
-	memcpy(&(buffer.command.data[iskip]), idata, ilen);
+	if (op->ilen)
+	{
+		memcpy(&(buffer.command.data[op->iskip]), op->idata, op->ilen);
+	}
 	/*! \bug Windows: hid_write() always returns 65 */
-	if (hid_write(hid_dev, (unsigned char *)&buffer, ilen+2+iskip) >=
-		ilen+2+iskip)
+	if (hid_write_timeout(hid_dev, (unsigned char *)&buffer,
+		op->ilen+2+op->iskip, timeout_ms) < op->ilen+2+op->iskip)
+	{
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+
+/*!
+ * \brief Receive and validate the response to a command sent by fcd_io_send()
+ * \param[in,out] hid_dev  HID device
+ * \param[in,out] op       command
+ * \param         deadline ms_now() time by which to give up (or -1 for none)
+ * \retval 0  success
+ * \retval 1  command failed (the device responded with a failure status)
+ * \retval -1 transport failure (\c errno is \c ETIMEDOUT on timeout)
+ * \note Responses to other commands are late ones to commands that timed
+ * out, and are discarded.
+ */
+static int fcd_io_receive(hid_device *hid_dev, fcd_io_op *op, int64_t deadline)
+{
+	fcd_buffer buffer;
+	int len;
+
+	do
 	{
 		/* receive response */
 		/*! \bug Windows: hid_read() always returns 64 */
-		if (hid_read(hid_dev, (unsigned char *)&buffer, olen+2) >= olen+2)
+		len = hid_read_timeout(hid_dev, (unsigned char *)&buffer,
+			op->olen+2, fcd_io_wait_ms(-1, deadline));
+		if (len < op->olen+2)
+		{
+			errno = len ? EIO : ETIMEDOUT;
+			return -1;
+		}
+	} while (buffer.response.command != op->cmd);
+	/* validate response */
+	if (buffer.response.status != 1)
+	{
+		errno = EIO;
+		return 1;
+	}
+	if (op->olen)
+	{
+		memcpy(op->odata, &buffer.response.data, op->olen);
+	}
+	return 0;
+}
+
+
+int fcd_io_pipeline(FCD *dev, fcd_io_op *ops, unsigned int count)
+{
+	return fcd_io_pipeline_until(dev, ops, count, -1);
+}
+
+
+int fcd_io_pipeline_until(FCD *dev, fcd_io_op *ops, unsigned int count,
+	int64_t deadline)
+{
+	hid_device *hid_dev;
+	int64_t sent_at[FCD_PIPELINE_DEPTH];
+	unsigned int depth, sent = 0, done = 0;
+	int broken = 0;
+	int timed_out = 0;
+	int reopen = 0;
+	int result = 0;
+
+	/* do not allow NULL pointer for device */
+	if (NULL == dev || (count && NULL == ops))
+	{
+		errno = EFAULT;
+		return -1;
+	}
+
+	/* the whole sequence is one transaction */
+	if (fcd_lock(dev))
+	{
+		for (done = 0; done < count; ++done)
+		{
+			ops[done].status = -1;
+		}
+		return -1;
+	}
+
+	hid_dev = fcd_hid_acquire(dev);
+	if (NULL == hid_dev)
+	{
+		fcd_unlock(dev);
+		for (done = 0; done < count; ++done)
+		{
+			ops[done].status = -1;
+		}
+		errno = ENODEV;
+		return -1;
+	}
+
+	/* direct reads only fetch responses on demand: do not queue behind them */
+	depth = (dev->flags & FCD_OPEN_DIRECT) ? 1 : FCD_PIPELINE_DEPTH;
+
+	while (done < count)
+	{
+		int64_t op_deadline;
+
+		/* keep up to depth commands in flight */
+		while (!broken && sent < count && sent - done < depth)
 		{
-			/* validate response */
-			if ((buffer.response.command == cmd) &&
-				(buffer.response.status == 1))
+			/* answer from the shadow of tuner state where possible */
+			ops[sent].cached = fcd_cache_lookup(dev, &ops[sent]);
+			if (!ops[sent].cached)
 			{
-				memcpy(odata, &buffer.response.data, olen);
-				result = 0;
+				fcd_cache_sent(dev, &ops[sent]);
+				if (fcd_io_send(hid_dev, &ops[sent],
+					fcd_io_wait_ms(dev->write_timeout_ms, deadline)))
+				{
+					broken = 1;
+					break;
+				}
+				if (dev->read_timeout_ms >= 0)
+				{
+					sent_at[sent % FCD_PIPELINE_DEPTH] = ms_now();
+				}
 			}
+			++sent;
 		}
+		if (done == sent)
+		{
+			/* nothing in flight: the remaining commands were never sent */
+			for (; done < count; ++done)
+			{
+				ops[done].status = -1;
+			}
+			result = -1;
+			break;
+		}
+		if (ops[done].cached)
+		{
+			ops[done].status = 0;
+			++done;
+			continue;
+		}
+
+		/* collect the oldest response (read timeout runs from its send) */
+		op_deadline = deadline;
+		if (dev->read_timeout_ms >= 0)
+		{
+			int64_t read_deadline = sent_at[done % FCD_PIPELINE_DEPTH] +
+				dev->read_timeout_ms;
+			if (op_deadline < 0 || read_deadline < op_deadline)
+			{
+				op_deadline = read_deadline;
+			}
+		}
+		ops[done].status = fcd_io_receive(hid_dev, &ops[done],
+			op_deadline);
+		fcd_cache_update(dev, &ops[done]);
+		if (ops[done].status)
+		{
+			result = -1;
+			if (ops[done].status < 0)
+			{
+				/* responses can no longer be matched to commands (a late
+				   one would look like the answer to a repeated command) */
+				timed_out = (ETIMEDOUT == errno);
+				for (++done; done < count; ++done)
+				{
+					ops[done].status = -1;
+				}
+				if (hid_dev == dev->hid)
+				{
+					/* late responses go with the device: start afresh */
+					dev->hid = NULL;
+					reopen = 1;
+				}
+				break;
+			}
+		}
+		++done;
 	}
 
-	hid_close(hid_dev);
+	fcd_hid_release(dev, hid_dev);
+	if (reopen)
+	{
+		/* if this fails, later commands open the device as needed */
+		dev->hid = fcd_hid_open(dev);
+		if (NULL != dev->hid)
+		{
+			fcd_hid_drain(dev->hid);
+		}
+	}
+	fcd_unlock(dev);
 
 	if (result)
 	{
-		errno = EIO;
+		errno = timed_out ? ETIMEDOUT : EIO;
 	}
 	return result;
 }
 
 
+int fcd_io(FCD *dev, unsigned char cmd, unsigned char iskip, const void *idata,
+	unsigned char ilen, void *odata, unsigned char olen)
+{
+	return fcd_io_until(dev, cmd, iskip, idata, ilen, odata, olen, -1);
+}
+
+
+int fcd_io_until(FCD *dev, unsigned char cmd, unsigned char iskip,
+	const void *idata, unsigned char ilen, void *odata, unsigned char olen,
+	int64_t deadline)
+{
+	fcd_io_op op;
+
+	op.cmd = cmd;
+	op.iskip = iskip;
+	op.idata = idata;
+	op.ilen = ilen;
+	op.odata = odata;
+	op.olen = olen;
+
+	return fcd_io_pipeline_until(dev, &op, 1, deadline);
+}
+
+
 int fcd_get(FCD *dev, unsigned char cmd, void *data, unsigned char len)
 {
 	return fcd_io(dev, cmd, 0, NULL, 0, data, len);
@@ -157,72 +627,115 @@ int fcd_reset(const char *path, void *context)
 
 API int fcd_for_each(fcd_path_callback *fn, void *context)
 {
-	struct hid_device_info *devs, *current;
+	char **paths;
+	unsigned int index;
 	int result = 0;
 
-	/* enumerate FUNcube dongles */
-	devs = hid_enumerate(FCD_USB_VID, FCD_USB_PID);
-	current = devs;
+	/* look up FUNcube dongles */
+	paths = fcd_registry_snapshot();
+	if (NULL == paths)
+	{
+		return -1;
+	}
 	/* for each FUNcube dongle */
-	while (NULL != current)
+	for (index = 0; NULL != paths[index]; ++index)
 	{
-		if (NULL != current->path)
+		/* call user function */
+		result = fn(paths[index], context);
+		if (result)
 		{
-			/* call user function */
-			result = fn(current->path, context);
-			if (result)
-			{
-				/* abort on first error */
-				break;
-			}
+			/* abort on first error */
+			break;
 		}
-		/* proceed to next device */
-		current = current->next;
 	}
-	hid_free_enumeration(devs);
+	free(paths);
 
 	return result;
 }
 
 
 API FCD * fcd_open(const char *path)
+{
+	return fcd_open_flags(path, FCD_OPEN_DEFAULT);
+}
+
+
+API FCD * fcd_open_flags(const char *path, unsigned int flags)
 {
 	FCD *dev;
 
 	dev = malloc(sizeof(FCD));
 	if (NULL != dev)
 	{
+		pthread_mutexattr_t attr;
+
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&dev->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+		dev->lock_depth = 0;
+		dev->lock_fd = -1;
+		dev->flags = flags;
+		dev->hid = NULL;
+		dev->worker = NULL;
+		dev->monitor = NULL;
+		dev->write_timeout_ms = FCD_WRITE_TIMEOUT_MS;
+		dev->read_timeout_ms = FCD_READ_TIMEOUT_MS;
+		dev->input_overflow = 0;
+		memset(&dev->shadow, 0, sizeof(dev->shadow));
+		memset(dev->settle, 0, sizeof(dev->settle));
+		memset(&dev->calibration, 0, sizeof(dev->calibration));
 		if (NULL == path)
 		{
-			/* use the first enumerated device path */
-			struct hid_device_info *devs;
-			devs = hid_enumerate(FCD_USB_VID, FCD_USB_PID);
-			if (NULL != devs && NULL != devs->path)
+			/* use the first registered device path */
+			char **paths = fcd_registry_snapshot();
+			if (NULL != paths && NULL != paths[0])
 			{
-				dev->path = strdup(devs->path);
+				dev->path = strdup(paths[0]);
 			}
 			else
 			{
 				dev->path = NULL;
 			}
-			hid_free_enumeration(devs);
+			free(paths);
 		}
 		else
 		{
-			/* open device to validate provided path */
-			hid_device *hid_dev;
-			hid_dev = hid_open_path(path);
-			if (NULL != hid_dev)
+			/* use provided path */
+			dev->path = strdup(path);
+		}
+		if (NULL != dev->path && (flags & FCD_OPEN_LOCK))
+		{
+			dev->lock_fd = fcd_lock_open(dev->path);
+			if (dev->lock_fd < 0)
 			{
-				/* use provided path */
-				dev->path = strdup(path);
+				free(dev->path);
+				dev->path = NULL;
 			}
-			else
+		}
+		if (NULL != dev->path && !fcd_lock(dev))
+		{
+			/* open device (also validates path) */
+			dev->hid = fcd_hid_open(dev);
+			if (NULL == dev->hid)
 			{
 				/* could not open path */
+				free(dev->path);
 				dev->path = NULL;
 			}
-			hid_close(hid_dev);
+			else if (flags & FCD_OPEN_TRANSIENT)
+			{
+				/* reopen for every command */
+				hid_close(dev->hid);
+				dev->hid = NULL;
+			}
+			fcd_unlock(dev);
+		}
+		else if (NULL != dev->path)
+		{
+			/* could not lock */
+			free(dev->path);
+			dev->path = NULL;
 		}
 		if (NULL == dev->path)
 		{
@@ -239,15 +752,73 @@ API void fcd_close(FCD *dev)
 {
 	if (NULL != dev)
 	{
+		fcd_monitor_stop(dev);
+		fcd_worker_stop(dev);
+		fcd_calibration_detach(dev, 1);
+		if (NULL != dev->hid)
+		{
+			hid_close(dev->hid);
+		}
 		if (NULL != dev->path)
 		{
 			free(dev->path);
 		}
+#ifdef HAVE_FLOCK
+		if (dev->lock_fd >= 0)
+		{
+			close(dev->lock_fd);
+		}
+#endif
+		pthread_mutex_destroy(&dev->lock);
 		free(dev);
 	}
 }
 
 
+API int fcd_set_timeouts(FCD *dev, int write_ms, int read_ms)
+{
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (write_ms < -1 || read_ms < -1)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	dev->write_timeout_ms = write_ms;
+	dev->read_timeout_ms = read_ms;
+	fcd_unlock(dev);
+	return 0;
+}
+
+
+API int fcd_get_input_overflow(FCD *dev, unsigned long *count)
+{
+	if (NULL == dev || NULL == count)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	*count = dev->input_overflow;
+	if (NULL != dev->hid)
+	{
+		*count += hid_get_input_overflow(dev->hid);
+	}
+	fcd_unlock(dev);
+	return 0;
+}
+
+
 API char * fcd_query(FCD *dev, char *str, int len)
 {
 	/* query device */
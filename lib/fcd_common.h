@@ -24,6 +24,8 @@
 # ifdef HAVE_STDINT_H
 #  include <stdint.h> /* [u]int*_t */
 # endif
+# include <pthread.h> /* pthread_mutex_t, pthread_cond_t */
+# include <time.h> /* struct timespec */
 # include "hidapi/hidapi.h" /* hid_* */
 
 # ifdef __cplusplus
@@ -37,11 +39,103 @@ extern "C"
  */
 
 
+/* Forward declaration of asynchronous command worker */
+struct fcd_worker;
+/* Forward declaration of IF RSSI / PLL lock monitor */
+struct fcd_monitor;
+
+/*! \brief Shadow of one tuner setting */
+typedef struct
+{
+	/*! \brief Non-zero if \p data matches the device */
+	unsigned char valid;
+	/*! \brief Command data (little-endian) */
+	unsigned char data[4];
+} fcd_shadow_entry;
+
+/*! \brief Shadow of tuner state (see fcd_cache_lookup()) */
+typedef struct
+{
+	/*! \brief 1-byte values (indexed by \ref FCD_VALUE_ENUM) */
+	fcd_shadow_entry value[FCD_VALUE_UNDEFINED];
+	/*! \brief Last requested frequency (in Hz) */
+	fcd_shadow_entry frequency;
+	/*! \brief Frequency reported by the device (in Hz) */
+	fcd_shadow_entry frequency_actual;
+	/*! \brief DC correction */
+	fcd_shadow_entry dc;
+	/*! \brief IQ correction */
+	fcd_shadow_entry iq;
+} fcd_shadow;
+
+/*! \brief Number of gain stages (LNA, mixer, and IF amplifiers 1 to 6) */
+#define FCD_GAIN_STAGES 8
+
+/*! \brief Number of settings of all gain stages together */
+#define FCD_GAIN_SETTINGS 38
+
+/*! \brief Gain stage (see \ref fcd_gain_stages) */
+typedef struct
+{
+	/*! \brief Value identifier */
+	FCD_VALUE_ENUM id;
+	/*! \brief Number of settings */
+	unsigned int count;
+	/*! \brief Index of first setting among all \ref FCD_GAIN_SETTINGS */
+	unsigned int offset;
+	/*! \brief Settings (lowest gain first, see fcd_tuner.h) */
+	const unsigned char *settings;
+	/*! \brief Nominal gain of each setting (in 0.01 dB) */
+	const short *nominal_cdB;
+} fcd_gain_stage;
+
+/*! \brief Calibration file of a device (see fcd_calibrate()) */
+typedef struct
+{
+	/*! \brief File path (\c NULL if the device has no serial number) */
+	char *path;
+	/*! \brief File contents (\c NULL if not calibrated) */
+	const unsigned char *data;
+	/*! \brief Size of \p data (in bytes) */
+	size_t size;
+	/*! \brief Non-zero once \p path has been looked up (on first use) */
+	int attached;
+} fcd_calibration_file;
+
+/*! \brief Number of bands with PLL settle statistics (see fcd_retune()) */
+#define FCD_SETTLE_BANDS 4
+
 /*! \brief Implementation of \ref FCD */
 struct FCD_impl
 {
 	/*! \brief HID device path */
 	char *path;
+	/*! \brief Open flags (\ref FCD_OPEN_FLAG_ENUM) */
+	unsigned int flags;
+	/*! \brief Persistent HID device (\c NULL for \ref FCD_OPEN_TRANSIENT) */
+	hid_device *hid;
+	/*! \brief Asynchronous command worker (\c NULL until first needed) */
+	struct fcd_worker *worker;
+	/*! \brief IF RSSI / PLL lock monitor (\c NULL unless started) */
+	struct fcd_monitor *monitor;
+	/*! \brief Command send timeout (in ms, -1 for forever) */
+	int write_timeout_ms;
+	/*! \brief Response timeout (in ms, -1 for forever) */
+	int read_timeout_ms;
+	/*! \brief Input reports dropped by closed HID devices */
+	unsigned long input_overflow;
+	/*! \brief Serializes transactions (recursive, see fcd_lock()) */
+	pthread_mutex_t lock;
+	/*! \brief Nesting depth of fcd_lock() */
+	unsigned int lock_depth;
+	/*! \brief Cross-process lock file (-1 without \ref FCD_OPEN_LOCK) */
+	int lock_fd;
+	/*! \brief Shadow of tuner state (unused with \ref FCD_OPEN_NO_CACHE) */
+	fcd_shadow shadow;
+	/*! \brief PLL settle statistics (by \ref FCD_TUNER_BAND_ENUM) */
+	fcd_settle_stats settle[FCD_SETTLE_BANDS];
+	/*! \brief Gain calibration */
+	fcd_calibration_file calibration;
 };
 
 /*! \brief FUNcube dongle command data length */
@@ -72,6 +166,39 @@ typedef struct
 	unsigned char data[FCD_RESPONSE_DATA_LEN];
 } fcd_response;
 
+/*! \brief Maximum number of commands in flight in fcd_io_pipeline() */
+#define FCD_PIPELINE_DEPTH 4
+
+/*! \brief Default command send timeout (in ms) */
+#define FCD_WRITE_TIMEOUT_MS 1000
+
+/*! \brief Default response timeout (in ms, -1 for forever) */
+#define FCD_READ_TIMEOUT_MS -1
+
+/*! \brief Time to wait for late responses after a reopen (in ms) */
+#define FCD_DRAIN_TIMEOUT_MS 10
+
+/*! \brief Single command for fcd_io_pipeline() */
+typedef struct
+{
+	/*! \brief Command ID */
+	unsigned char cmd;
+	/*! \brief Number of input data bytes to skip (normally 0) */
+	unsigned char iskip;
+	/*! \brief Input data pointer */
+	const void *idata;
+	/*! \brief Input data length */
+	unsigned char ilen;
+	/*! \brief Output data pointer */
+	void *odata;
+	/*! \brief Output data length */
+	unsigned char olen;
+	/*! \brief Result (0 success, 1 command failed, -1 transport failure) */
+	int status;
+	/*! \brief Non-zero if answered by fcd_cache_lookup() (not sent) */
+	int cached;
+} fcd_io_op;
+
 /*! \brief Shared command/response buffer type */
 typedef union
 {
@@ -139,6 +266,66 @@ static inline uint16_t convert_le_u16(uint16_t v)
  */
 void ms_sleep(unsigned int ms);
 
+/*!
+ * \brief Get monotonic time
+ * \returns milliseconds since an unspecified starting point
+ */
+int64_t ms_now(void);
+
+/*!
+ * \brief Get monotonic time in microseconds
+ * \returns microseconds since the same starting point as ms_now()
+ */
+int64_t us_now(void);
+
+/*!
+ * \brief Initialize a condition variable that times out on the monotonic clock
+ * \param[out] cond condition variable
+ * \note Pair with fcd_cond_deadline() for pthread_cond_timedwait().
+ */
+void fcd_cond_init(pthread_cond_t *cond);
+
+/*!
+ * \brief Get a pthread_cond_timedwait() deadline for fcd_cond_init()
+ * \param[out] ts deadline
+ * \param      ms milliseconds from now
+ */
+void fcd_cond_deadline(struct timespec *ts, unsigned int ms);
+
+/*!
+ * \brief Begin a transaction on a device
+ * \param[in,out] dev open \ref FCD
+ * \retval 0     success
+ * \retval non-0 failure
+ * \note Transactions nest. Each successful call must be matched by a call to
+ * fcd_unlock(). The outermost transaction also holds the cross-process lock
+ * (see \ref FCD_OPEN_LOCK).
+ */
+int fcd_lock(FCD *dev);
+
+/*!
+ * \brief End a transaction begun by fcd_lock()
+ * \param[in,out] dev open \ref FCD
+ */
+void fcd_unlock(FCD *dev);
+
+/*!
+ * \brief Keep a HID device open for a run of transactions
+ * \param[in,out] dev open \ref FCD (locked with fcd_lock())
+ * \retval 1  HID device opened (for \ref FCD_OPEN_TRANSIENT)
+ * \retval 0  HID device was already open
+ * \retval -1 failure
+ * \note Pass the result to fcd_unpin() before calling fcd_unlock().
+ */
+int fcd_pin(FCD *dev);
+
+/*!
+ * \brief Undo fcd_pin()
+ * \param[in,out] dev    open \ref FCD (locked with fcd_lock())
+ * \param         pinned result of fcd_pin()
+ */
+void fcd_unpin(FCD *dev, int pinned);
+
 /*! \brief Perform an I/O command
  * \param[in,out] dev   open \ref FCD
  * \param         cmd   command ID
@@ -153,6 +340,34 @@ void ms_sleep(unsigned int ms);
 int fcd_io(FCD *dev, unsigned char cmd, unsigned char iskip, const void *idata,
 	unsigned char ilen, void *odata, unsigned char olen);
 
+/*! \brief Perform an I/O command by a deadline
+ * \copydetails fcd_io
+ * \param deadline ms_now() time by which to give up (or -1 for none)
+ * \note The per-handle timeouts still apply.
+ */
+int fcd_io_until(FCD *dev, unsigned char cmd, unsigned char iskip,
+	const void *idata, unsigned char ilen, void *odata, unsigned char olen,
+	int64_t deadline);
+
+/*! \brief Perform a sequence of I/O commands with several in flight
+ * \param[in,out] dev   open \ref FCD
+ * \param[in,out] ops   commands (each \p status is set)
+ * \param         count number of commands
+ * \retval 0     success (all commands succeeded)
+ * \retval non-0 failure (see each \p status)
+ * \note Responses are collected in order. After a transport failure no
+ * further commands are sent.
+ */
+int fcd_io_pipeline(FCD *dev, fcd_io_op *ops, unsigned int count);
+
+/*! \brief Perform a sequence of I/O commands by a deadline
+ * \copydetails fcd_io_pipeline
+ * \param deadline ms_now() time by which to give up (or -1 for none)
+ * \note The per-handle timeouts still apply to each command.
+ */
+int fcd_io_pipeline_until(FCD *dev, fcd_io_op *ops, unsigned int count,
+	int64_t deadline);
+
 /*! \brief Perform a get command
  * \param[in,out] dev  open \ref FCD
  * \param         cmd  command ID
@@ -173,6 +388,77 @@ int fcd_get(FCD *dev, unsigned char cmd, void *data, unsigned char len);
  */
 int fcd_set(FCD *dev, unsigned char cmd, const void *data, unsigned char len);
 
+/*!
+ * \brief Get the paths of all attached FUNcube dongles
+ * \retval non-NULL \c NULL-terminated path list (release with a single free())
+ * \retval NULL     error
+ * \note The list is served from a process-wide registry, which is only
+ * re-enumerated when HID hotplug reports a change (or on every call if
+ * hotplug notification is not supported).
+ */
+char ** fcd_registry_snapshot(void);
+
+/*!
+ * \brief Answer a command from the shadow of tuner state, if possible
+ * \param[in,out] dev open \ref FCD (transaction held)
+ * \param[in,out] op  command (output is filled in if answered)
+ * \retval 1 answered (a get served from the shadow, or a set that would not
+ * change anything)
+ * \retval 0 the command must be sent
+ */
+int fcd_cache_lookup(FCD *dev, fcd_io_op *op);
+
+/*!
+ * \brief Update the shadow of tuner state for a command being sent
+ * \param[in,out] dev open \ref FCD (transaction held)
+ * \param[in]     op  command
+ */
+void fcd_cache_sent(FCD *dev, const fcd_io_op *op);
+
+/*!
+ * \brief Update the shadow of tuner state for a completed command
+ * \param[in,out] dev open \ref FCD (transaction held)
+ * \param[in]     op  command (with \p status set)
+ */
+void fcd_cache_update(FCD *dev, const fcd_io_op *op);
+
+/*!
+ * \brief Stop the asynchronous command worker of a device (if any)
+ * \param[in,out] dev open \ref FCD
+ * \post All previously queued commands have run.
+ */
+void fcd_worker_stop(FCD *dev);
+
+/*!
+ * \brief Unload the calibration file of a device
+ * \param[in,out] dev open \ref FCD
+ * \param         all  non-zero to also forget the file path
+ */
+void fcd_calibration_detach(FCD *dev, int all);
+
+/*! \brief Gain stages, front end first */
+extern const fcd_gain_stage fcd_gain_stages[FCD_GAIN_STAGES];
+
+/*!
+ * \brief Find a setting of a gain stage
+ * \param[in] stage   gain stage
+ * \param     setting setting
+ * \retval >=0 index into \p stage settings
+ * \retval -1  not a setting of \p stage
+ */
+int fcd_gain_find(const fcd_gain_stage *stage, unsigned char setting);
+
+/*!
+ * \brief Take one automatic gain control step (see fcd_agc_start())
+ * \param[in,out] dev  open \ref FCD
+ * \param         rssi IF RSSI just measured
+ * \param         low  lowest IF RSSI to leave alone
+ * \param         high highest IF RSSI to leave alone
+ * \note Changes at most one gain stage, by one setting.
+ */
+void fcd_agc_step(FCD *dev, unsigned char rssi, unsigned char low,
+	unsigned char high);
+
 /*! \copydetails fcd_path_callback
  * \brief Reset FUNcube dongle
  * \note \p context points to specified reset command
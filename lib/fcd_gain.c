@@ -0,0 +1,450 @@
+/*! \file
+ * \brief FUNcube dongle gain stage and total gain implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <stdlib.h> /* NULL */
+#include "fcd.h" /* FCD, FCD_BATCH, fcd_set_total_gain_dB */
+#include "fcd_tuner.h" /* FCD_T*E_* */
+#include "fcd_common.h"
+
+
+/*
+ * Types
+ */
+
+
+/*! \brief Number of total gains (one per dB) */
+#define FCD_GAIN_ENTRIES (FCD_TOTAL_GAIN_MAX_DB - FCD_TOTAL_GAIN_MIN_DB + 1)
+
+/*! \brief Gain stage settings for one total gain */
+typedef struct
+{
+	/*! \brief Settings (in \ref fcd_gain_stages order) */
+	unsigned char setting[FCD_GAIN_STAGES];
+} fcd_gain_entry;
+
+
+/*
+ * Constants
+ */
+
+
+/*! \brief LNA gain settings */
+static const unsigned char fcd_gain_lna[] =
+{
+	FCD_TLGE_N5_0DB, FCD_TLGE_N2_5DB, FCD_TLGE_P0_0DB, FCD_TLGE_P2_5DB,
+	FCD_TLGE_P5_0DB, FCD_TLGE_P7_5DB, FCD_TLGE_P10_0DB, FCD_TLGE_P12_5DB,
+	FCD_TLGE_P15_0DB, FCD_TLGE_P17_5DB, FCD_TLGE_P20_0DB, FCD_TLGE_P25_0DB,
+	FCD_TLGE_P30_0DB
+};
+
+/*! \brief LNA gains (in 0.01 dB) */
+static const short fcd_gain_lna_cdB[] =
+{
+	-500, -250, 0, 250, 500, 750, 1000, 1250, 1500, 1750, 2000, 2500, 3000
+};
+
+/*! \brief Mixer gain settings */
+static const unsigned char fcd_gain_mixer[] =
+{
+	FCD_TMGE_P4_0DB, FCD_TMGE_P12_0DB
+};
+
+/*! \brief Mixer gains (in 0.01 dB) */
+static const short fcd_gain_mixer_cdB[] =
+{
+	400, 1200
+};
+
+/*! \brief IF amplifier 1 gain settings */
+static const unsigned char fcd_gain_if1[] =
+{
+	FCD_TIG1E_N3_0DB, FCD_TIG1E_P6_0DB
+};
+
+/*! \brief IF amplifier 1 gains (in 0.01 dB) */
+static const short fcd_gain_if1_cdB[] =
+{
+	-300, 600
+};
+
+/*! \brief IF amplifier 2 (and 3) gain settings */
+static const unsigned char fcd_gain_if2[] =
+{
+	FCD_TIG2E_P0_0DB, FCD_TIG2E_P3_0DB, FCD_TIG2E_P6_0DB, FCD_TIG2E_P9_0DB
+};
+
+/*! \brief IF amplifier 2 (and 3) gains (in 0.01 dB) */
+static const short fcd_gain_if2_cdB[] =
+{
+	0, 300, 600, 900
+};
+
+/*! \brief IF amplifier 4 gain settings */
+static const unsigned char fcd_gain_if4[] =
+{
+	FCD_TIG4E_P0_0DB, FCD_TIG4E_P1_0DB, FCD_TIG4E_P2_0DB
+};
+
+/*! \brief IF amplifier 4 gains (in 0.01 dB) */
+static const short fcd_gain_if4_cdB[] =
+{
+	0, 100, 200
+};
+
+/*! \brief IF amplifier 5 (and 6) gain settings */
+static const unsigned char fcd_gain_if5[] =
+{
+	FCD_TIG5E_P3_0DB, FCD_TIG5E_P6_0DB, FCD_TIG5E_P9_0DB, FCD_TIG5E_P12_0DB,
+	FCD_TIG5E_P15_0DB
+};
+
+/*! \brief IF amplifier 5 (and 6) gains (in 0.01 dB) */
+static const short fcd_gain_if5_cdB[] =
+{
+	300, 600, 900, 1200, 1500
+};
+
+const fcd_gain_stage fcd_gain_stages[FCD_GAIN_STAGES] =
+{
+	{FCD_VALUE_LNA_GAIN, 13, 0, fcd_gain_lna, fcd_gain_lna_cdB},
+	{FCD_VALUE_MIXER_GAIN, 2, 13, fcd_gain_mixer, fcd_gain_mixer_cdB},
+	{FCD_VALUE_IF_GAIN1, 2, 15, fcd_gain_if1, fcd_gain_if1_cdB},
+	{FCD_VALUE_IF_GAIN2, 4, 17, fcd_gain_if2, fcd_gain_if2_cdB},
+	{FCD_VALUE_IF_GAIN3, 4, 21, fcd_gain_if2, fcd_gain_if2_cdB},
+	{FCD_VALUE_IF_GAIN4, 3, 25, fcd_gain_if4, fcd_gain_if4_cdB},
+	{FCD_VALUE_IF_GAIN5, 5, 28, fcd_gain_if5, fcd_gain_if5_cdB},
+	{FCD_VALUE_IF_GAIN6, 5, 33, fcd_gain_if5, fcd_gain_if5_cdB}
+};
+
+/*
+ * The tables below hold, for each total gain, the combination of settings
+ * (see fcd_tuner.h) whose stage gains add up to exactly that total. Of all
+ * such combinations, the noise figure table takes the one with the most
+ * gain in the earliest stages (LNA, then mixer, then IF1, ...), and the
+ * linearity table the one with the least.
+ */
+
+/*! \brief Settings by total gain, for \ref FCD_GAIN_NOISE_FIGURE */
+static const fcd_gain_entry fcd_gain_noise_figure[FCD_GAIN_ENTRIES] =
+{
+	/* LNA, mixer, IF1, IF2, IF3, IF4, IF5, IF6 */
+	{{ 0, 0, 0, 0, 0, 0, 0, 0}}, /*  2 dB */
+	{{ 0, 0, 0, 0, 0, 1, 0, 0}}, /*  3 dB */
+	{{ 0, 0, 0, 0, 0, 2, 0, 0}}, /*  4 dB */
+	{{ 0, 0, 0, 1, 0, 0, 0, 0}}, /*  5 dB */
+	{{ 0, 0, 0, 1, 0, 1, 0, 0}}, /*  6 dB */
+	{{ 4, 0, 0, 0, 0, 0, 0, 0}}, /*  7 dB */
+	{{ 4, 0, 0, 0, 0, 1, 0, 0}}, /*  8 dB */
+	{{ 4, 0, 0, 0, 0, 2, 0, 0}}, /*  9 dB */
+	{{ 4, 0, 0, 1, 0, 0, 0, 0}}, /* 10 dB */
+	{{ 4, 0, 0, 1, 0, 1, 0, 0}}, /* 11 dB */
+	{{ 6, 0, 0, 0, 0, 0, 0, 0}}, /* 12 dB */
+	{{ 6, 0, 0, 0, 0, 1, 0, 0}}, /* 13 dB */
+	{{ 6, 0, 0, 0, 0, 2, 0, 0}}, /* 14 dB */
+	{{ 6, 0, 0, 1, 0, 0, 0, 0}}, /* 15 dB */
+	{{ 6, 0, 0, 1, 0, 1, 0, 0}}, /* 16 dB */
+	{{ 8, 0, 0, 0, 0, 0, 0, 0}}, /* 17 dB */
+	{{ 8, 0, 0, 0, 0, 1, 0, 0}}, /* 18 dB */
+	{{ 8, 0, 0, 0, 0, 2, 0, 0}}, /* 19 dB */
+	{{ 8, 0, 0, 1, 0, 0, 0, 0}}, /* 20 dB */
+	{{ 8, 0, 0, 1, 0, 1, 0, 0}}, /* 21 dB */
+	{{10, 0, 0, 0, 0, 0, 0, 0}}, /* 22 dB */
+	{{10, 0, 0, 0, 0, 1, 0, 0}}, /* 23 dB */
+	{{10, 0, 0, 0, 0, 2, 0, 0}}, /* 24 dB */
+	{{10, 0, 0, 1, 0, 0, 0, 0}}, /* 25 dB */
+	{{10, 0, 0, 1, 0, 1, 0, 0}}, /* 26 dB */
+	{{12, 0, 0, 0, 0, 0, 0, 0}}, /* 27 dB */
+	{{12, 0, 0, 0, 0, 1, 0, 0}}, /* 28 dB */
+	{{12, 0, 0, 0, 0, 2, 0, 0}}, /* 29 dB */
+	{{12, 0, 0, 1, 0, 0, 0, 0}}, /* 30 dB */
+	{{12, 0, 0, 1, 0, 1, 0, 0}}, /* 31 dB */
+	{{13, 0, 0, 0, 0, 0, 0, 0}}, /* 32 dB */
+	{{13, 0, 0, 0, 0, 1, 0, 0}}, /* 33 dB */
+	{{13, 0, 0, 0, 0, 2, 0, 0}}, /* 34 dB */
+	{{13, 0, 0, 1, 0, 0, 0, 0}}, /* 35 dB */
+	{{13, 0, 0, 1, 0, 1, 0, 0}}, /* 36 dB */
+	{{14, 0, 0, 0, 0, 0, 0, 0}}, /* 37 dB */
+	{{14, 0, 0, 0, 0, 1, 0, 0}}, /* 38 dB */
+	{{14, 0, 0, 0, 0, 2, 0, 0}}, /* 39 dB */
+	{{14, 0, 0, 1, 0, 0, 0, 0}}, /* 40 dB */
+	{{14, 0, 0, 1, 0, 1, 0, 0}}, /* 41 dB */
+	{{14, 0, 0, 1, 0, 2, 0, 0}}, /* 42 dB */
+	{{14, 0, 0, 2, 0, 0, 0, 0}}, /* 43 dB */
+	{{14, 0, 0, 2, 0, 1, 0, 0}}, /* 44 dB */
+	{{14, 1, 0, 0, 0, 0, 0, 0}}, /* 45 dB */
+	{{14, 1, 0, 0, 0, 1, 0, 0}}, /* 46 dB */
+	{{14, 1, 0, 0, 0, 2, 0, 0}}, /* 47 dB */
+	{{14, 1, 0, 1, 0, 0, 0, 0}}, /* 48 dB */
+	{{14, 1, 0, 1, 0, 1, 0, 0}}, /* 49 dB */
+	{{14, 1, 0, 1, 0, 2, 0, 0}}, /* 50 dB */
+	{{14, 1, 0, 2, 0, 0, 0, 0}}, /* 51 dB */
+	{{14, 1, 0, 2, 0, 1, 0, 0}}, /* 52 dB */
+	{{14, 1, 0, 2, 0, 2, 0, 0}}, /* 53 dB */
+	{{14, 1, 1, 0, 0, 0, 0, 0}}, /* 54 dB */
+	{{14, 1, 1, 0, 0, 1, 0, 0}}, /* 55 dB */
+	{{14, 1, 1, 0, 0, 2, 0, 0}}, /* 56 dB */
+	{{14, 1, 1, 1, 0, 0, 0, 0}}, /* 57 dB */
+	{{14, 1, 1, 1, 0, 1, 0, 0}}, /* 58 dB */
+	{{14, 1, 1, 1, 0, 2, 0, 0}}, /* 59 dB */
+	{{14, 1, 1, 2, 0, 0, 0, 0}}, /* 60 dB */
+	{{14, 1, 1, 2, 0, 1, 0, 0}}, /* 61 dB */
+	{{14, 1, 1, 2, 0, 2, 0, 0}}, /* 62 dB */
+	{{14, 1, 1, 3, 0, 0, 0, 0}}, /* 63 dB */
+	{{14, 1, 1, 3, 0, 1, 0, 0}}, /* 64 dB */
+	{{14, 1, 1, 3, 0, 2, 0, 0}}, /* 65 dB */
+	{{14, 1, 1, 3, 1, 0, 0, 0}}, /* 66 dB */
+	{{14, 1, 1, 3, 1, 1, 0, 0}}, /* 67 dB */
+	{{14, 1, 1, 3, 1, 2, 0, 0}}, /* 68 dB */
+	{{14, 1, 1, 3, 2, 0, 0, 0}}, /* 69 dB */
+	{{14, 1, 1, 3, 2, 1, 0, 0}}, /* 70 dB */
+	{{14, 1, 1, 3, 2, 2, 0, 0}}, /* 71 dB */
+	{{14, 1, 1, 3, 3, 0, 0, 0}}, /* 72 dB */
+	{{14, 1, 1, 3, 3, 1, 0, 0}}, /* 73 dB */
+	{{14, 1, 1, 3, 3, 2, 0, 0}}, /* 74 dB */
+	{{14, 1, 1, 3, 3, 0, 1, 0}}, /* 75 dB */
+	{{14, 1, 1, 3, 3, 1, 1, 0}}, /* 76 dB */
+	{{14, 1, 1, 3, 3, 2, 1, 0}}, /* 77 dB */
+	{{14, 1, 1, 3, 3, 0, 2, 0}}, /* 78 dB */
+	{{14, 1, 1, 3, 3, 1, 2, 0}}, /* 79 dB */
+	{{14, 1, 1, 3, 3, 2, 2, 0}}, /* 80 dB */
+	{{14, 1, 1, 3, 3, 0, 3, 0}}, /* 81 dB */
+	{{14, 1, 1, 3, 3, 1, 3, 0}}, /* 82 dB */
+	{{14, 1, 1, 3, 3, 2, 3, 0}}, /* 83 dB */
+	{{14, 1, 1, 3, 3, 0, 4, 0}}, /* 84 dB */
+	{{14, 1, 1, 3, 3, 1, 4, 0}}, /* 85 dB */
+	{{14, 1, 1, 3, 3, 2, 4, 0}}, /* 86 dB */
+	{{14, 1, 1, 3, 3, 0, 4, 1}}, /* 87 dB */
+	{{14, 1, 1, 3, 3, 1, 4, 1}}, /* 88 dB */
+	{{14, 1, 1, 3, 3, 2, 4, 1}}, /* 89 dB */
+	{{14, 1, 1, 3, 3, 0, 4, 2}}, /* 90 dB */
+	{{14, 1, 1, 3, 3, 1, 4, 2}}, /* 91 dB */
+	{{14, 1, 1, 3, 3, 2, 4, 2}}, /* 92 dB */
+	{{14, 1, 1, 3, 3, 0, 4, 3}}, /* 93 dB */
+	{{14, 1, 1, 3, 3, 1, 4, 3}}, /* 94 dB */
+	{{14, 1, 1, 3, 3, 2, 4, 3}}, /* 95 dB */
+	{{14, 1, 1, 3, 3, 0, 4, 4}}, /* 96 dB */
+	{{14, 1, 1, 3, 3, 1, 4, 4}}, /* 97 dB */
+	{{14, 1, 1, 3, 3, 2, 4, 4}}, /* 98 dB */
+};
+
+/*! \brief Settings by total gain, for \ref FCD_GAIN_LINEARITY */
+static const fcd_gain_entry fcd_gain_linearity[FCD_GAIN_ENTRIES] =
+{
+	/* LNA, mixer, IF1, IF2, IF3, IF4, IF5, IF6 */
+	{{ 0, 0, 0, 0, 0, 0, 0, 0}}, /*  2 dB */
+	{{ 0, 0, 0, 0, 0, 1, 0, 0}}, /*  3 dB */
+	{{ 0, 0, 0, 0, 0, 2, 0, 0}}, /*  4 dB */
+	{{ 0, 0, 0, 0, 0, 0, 0, 1}}, /*  5 dB */
+	{{ 0, 0, 0, 0, 0, 1, 0, 1}}, /*  6 dB */
+	{{ 0, 0, 0, 0, 0, 2, 0, 1}}, /*  7 dB */
+	{{ 0, 0, 0, 0, 0, 0, 0, 2}}, /*  8 dB */
+	{{ 0, 0, 0, 0, 0, 1, 0, 2}}, /*  9 dB */
+	{{ 0, 0, 0, 0, 0, 2, 0, 2}}, /* 10 dB */
+	{{ 0, 0, 0, 0, 0, 0, 0, 3}}, /* 11 dB */
+	{{ 0, 0, 0, 0, 0, 1, 0, 3}}, /* 12 dB */
+	{{ 0, 0, 0, 0, 0, 2, 0, 3}}, /* 13 dB */
+	{{ 0, 0, 0, 0, 0, 0, 0, 4}}, /* 14 dB */
+	{{ 0, 0, 0, 0, 0, 1, 0, 4}}, /* 15 dB */
+	{{ 0, 0, 0, 0, 0, 2, 0, 4}}, /* 16 dB */
+	{{ 0, 0, 0, 0, 0, 0, 1, 4}}, /* 17 dB */
+	{{ 0, 0, 0, 0, 0, 1, 1, 4}}, /* 18 dB */
+	{{ 0, 0, 0, 0, 0, 2, 1, 4}}, /* 19 dB */
+	{{ 0, 0, 0, 0, 0, 0, 2, 4}}, /* 20 dB */
+	{{ 0, 0, 0, 0, 0, 1, 2, 4}}, /* 21 dB */
+	{{ 0, 0, 0, 0, 0, 2, 2, 4}}, /* 22 dB */
+	{{ 0, 0, 0, 0, 0, 0, 3, 4}}, /* 23 dB */
+	{{ 0, 0, 0, 0, 0, 1, 3, 4}}, /* 24 dB */
+	{{ 0, 0, 0, 0, 0, 2, 3, 4}}, /* 25 dB */
+	{{ 0, 0, 0, 0, 0, 0, 4, 4}}, /* 26 dB */
+	{{ 0, 0, 0, 0, 0, 1, 4, 4}}, /* 27 dB */
+	{{ 0, 0, 0, 0, 0, 2, 4, 4}}, /* 28 dB */
+	{{ 0, 0, 0, 0, 1, 0, 4, 4}}, /* 29 dB */
+	{{ 0, 0, 0, 0, 1, 1, 4, 4}}, /* 30 dB */
+	{{ 0, 0, 0, 0, 1, 2, 4, 4}}, /* 31 dB */
+	{{ 0, 0, 0, 0, 2, 0, 4, 4}}, /* 32 dB */
+	{{ 0, 0, 0, 0, 2, 1, 4, 4}}, /* 33 dB */
+	{{ 0, 0, 0, 0, 2, 2, 4, 4}}, /* 34 dB */
+	{{ 0, 0, 0, 0, 3, 0, 4, 4}}, /* 35 dB */
+	{{ 0, 0, 0, 0, 3, 1, 4, 4}}, /* 36 dB */
+	{{ 0, 0, 0, 0, 3, 2, 4, 4}}, /* 37 dB */
+	{{ 0, 0, 0, 1, 3, 0, 4, 4}}, /* 38 dB */
+	{{ 0, 0, 0, 1, 3, 1, 4, 4}}, /* 39 dB */
+	{{ 0, 0, 0, 1, 3, 2, 4, 4}}, /* 40 dB */
+	{{ 0, 0, 0, 2, 3, 0, 4, 4}}, /* 41 dB */
+	{{ 0, 0, 0, 2, 3, 1, 4, 4}}, /* 42 dB */
+	{{ 0, 0, 0, 2, 3, 2, 4, 4}}, /* 43 dB */
+	{{ 0, 0, 0, 3, 3, 0, 4, 4}}, /* 44 dB */
+	{{ 0, 0, 0, 3, 3, 1, 4, 4}}, /* 45 dB */
+	{{ 0, 0, 0, 3, 3, 2, 4, 4}}, /* 46 dB */
+	{{ 0, 0, 1, 1, 3, 0, 4, 4}}, /* 47 dB */
+	{{ 0, 0, 1, 1, 3, 1, 4, 4}}, /* 48 dB */
+	{{ 0, 0, 1, 1, 3, 2, 4, 4}}, /* 49 dB */
+	{{ 0, 0, 1, 2, 3, 0, 4, 4}}, /* 50 dB */
+	{{ 0, 0, 1, 2, 3, 1, 4, 4}}, /* 51 dB */
+	{{ 0, 0, 1, 2, 3, 2, 4, 4}}, /* 52 dB */
+	{{ 0, 0, 1, 3, 3, 0, 4, 4}}, /* 53 dB */
+	{{ 0, 0, 1, 3, 3, 1, 4, 4}}, /* 54 dB */
+	{{ 0, 0, 1, 3, 3, 2, 4, 4}}, /* 55 dB */
+	{{ 0, 1, 1, 1, 3, 1, 4, 4}}, /* 56 dB */
+	{{ 0, 1, 1, 1, 3, 2, 4, 4}}, /* 57 dB */
+	{{ 0, 1, 1, 2, 3, 0, 4, 4}}, /* 58 dB */
+	{{ 0, 1, 1, 2, 3, 1, 4, 4}}, /* 59 dB */
+	{{ 0, 1, 1, 2, 3, 2, 4, 4}}, /* 60 dB */
+	{{ 0, 1, 1, 3, 3, 0, 4, 4}}, /* 61 dB */
+	{{ 0, 1, 1, 3, 3, 1, 4, 4}}, /* 62 dB */
+	{{ 0, 1, 1, 3, 3, 2, 4, 4}}, /* 63 dB */
+	{{ 4, 1, 1, 2, 3, 1, 4, 4}}, /* 64 dB */
+	{{ 4, 1, 1, 2, 3, 2, 4, 4}}, /* 65 dB */
+	{{ 4, 1, 1, 3, 3, 0, 4, 4}}, /* 66 dB */
+	{{ 4, 1, 1, 3, 3, 1, 4, 4}}, /* 67 dB */
+	{{ 4, 1, 1, 3, 3, 2, 4, 4}}, /* 68 dB */
+	{{ 6, 1, 1, 2, 3, 1, 4, 4}}, /* 69 dB */
+	{{ 6, 1, 1, 2, 3, 2, 4, 4}}, /* 70 dB */
+	{{ 6, 1, 1, 3, 3, 0, 4, 4}}, /* 71 dB */
+	{{ 6, 1, 1, 3, 3, 1, 4, 4}}, /* 72 dB */
+	{{ 6, 1, 1, 3, 3, 2, 4, 4}}, /* 73 dB */
+	{{ 8, 1, 1, 2, 3, 1, 4, 4}}, /* 74 dB */
+	{{ 8, 1, 1, 2, 3, 2, 4, 4}}, /* 75 dB */
+	{{ 8, 1, 1, 3, 3, 0, 4, 4}}, /* 76 dB */
+	{{ 8, 1, 1, 3, 3, 1, 4, 4}}, /* 77 dB */
+	{{ 8, 1, 1, 3, 3, 2, 4, 4}}, /* 78 dB */
+	{{10, 1, 1, 2, 3, 1, 4, 4}}, /* 79 dB */
+	{{10, 1, 1, 2, 3, 2, 4, 4}}, /* 80 dB */
+	{{10, 1, 1, 3, 3, 0, 4, 4}}, /* 81 dB */
+	{{10, 1, 1, 3, 3, 1, 4, 4}}, /* 82 dB */
+	{{10, 1, 1, 3, 3, 2, 4, 4}}, /* 83 dB */
+	{{12, 1, 1, 2, 3, 1, 4, 4}}, /* 84 dB */
+	{{12, 1, 1, 2, 3, 2, 4, 4}}, /* 85 dB */
+	{{12, 1, 1, 3, 3, 0, 4, 4}}, /* 86 dB */
+	{{12, 1, 1, 3, 3, 1, 4, 4}}, /* 87 dB */
+	{{12, 1, 1, 3, 3, 2, 4, 4}}, /* 88 dB */
+	{{13, 1, 1, 2, 3, 1, 4, 4}}, /* 89 dB */
+	{{13, 1, 1, 2, 3, 2, 4, 4}}, /* 90 dB */
+	{{13, 1, 1, 3, 3, 0, 4, 4}}, /* 91 dB */
+	{{13, 1, 1, 3, 3, 1, 4, 4}}, /* 92 dB */
+	{{13, 1, 1, 3, 3, 2, 4, 4}}, /* 93 dB */
+	{{14, 1, 1, 2, 3, 1, 4, 4}}, /* 94 dB */
+	{{14, 1, 1, 2, 3, 2, 4, 4}}, /* 95 dB */
+	{{14, 1, 1, 3, 3, 0, 4, 4}}, /* 96 dB */
+	{{14, 1, 1, 3, 3, 1, 4, 4}}, /* 97 dB */
+	{{14, 1, 1, 3, 3, 2, 4, 4}}, /* 98 dB */
+};
+
+
+/*
+ * Functions
+ */
+
+
+int fcd_gain_find(const fcd_gain_stage *stage, unsigned char setting)
+{
+	unsigned int index;
+
+	for (index = 0; index < stage->count; ++index)
+	{
+		if (stage->settings[index] == setting)
+		{
+			return (int) index;
+		}
+	}
+	return -1;
+}
+
+
+API int fcd_set_total_gain_dB(FCD *dev, int dB, FCD_GAIN_MODE_ENUM mode)
+{
+	const fcd_gain_entry *entry;
+	fcd_batch_result results[FCD_GAIN_STAGES];
+	FCD_BATCH *batch;
+	unsigned int stage;
+	int result = -1;
+
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (dB < FCD_TOTAL_GAIN_MIN_DB || dB > FCD_TOTAL_GAIN_MAX_DB)
+	{
+		/* value out of range */
+		errno = EOVERFLOW;
+		return -1;
+	}
+	switch (mode)
+	{
+		case FCD_GAIN_NOISE_FIGURE:
+			entry = &fcd_gain_noise_figure[dB - FCD_TOTAL_GAIN_MIN_DB];
+			break;
+		case FCD_GAIN_LINEARITY:
+			entry = &fcd_gain_linearity[dB - FCD_TOTAL_GAIN_MIN_DB];
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+
+	batch = fcd_batch_new();
+	if (NULL == batch)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* compare and apply as one transaction */
+	if (fcd_lock(dev))
+	{
+		fcd_batch_free(batch);
+		return -1;
+	}
+	for (stage = 0; stage < FCD_GAIN_STAGES; ++stage)
+	{
+		if (fcd_batch_get_value(batch, fcd_gain_stages[stage].id) < 0)
+		{
+			goto done;
+		}
+	}
+	/* normally answered from the shadow of tuner state */
+	if (fcd_batch_run(dev, batch, results))
+	{
+		goto done;
+	}
+
+	fcd_batch_clear(batch);
+	for (stage = 0; stage < FCD_GAIN_STAGES; ++stage)
+	{
+		if (results[stage].value != entry->setting[stage] &&
+			fcd_batch_set_value(batch, fcd_gain_stages[stage].id,
+				entry->setting[stage]) < 0)
+		{
+			goto done;
+		}
+	}
+	result = fcd_batch_run(dev, batch, NULL);
+
+done:
+	fcd_unlock(dev);
+	fcd_batch_free(batch);
+	return result;
+}
@@ -0,0 +1,399 @@
+/*! \file
+ * \brief FUNcube dongle IF RSSI / PLL lock monitor (and AGC) implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <pthread.h> /* pthread_* */
+#include <stdlib.h> /* NULL, malloc, free */
+#include <string.h> /* memset */
+#include <time.h> /* struct timespec */
+#include "fcd.h" /* FCD, fcd_monitor_*, fcd_agc_* */
+#include "fcd_cmd.h" /* FCD_CMD_* */
+#include "fcd_common.h"
+
+
+/*
+ * Defines
+ */
+
+/*! \brief Number of samples kept (must be a power of 2) */
+#define FCD_MONITOR_SLOTS 1024
+
+/*! \brief Minimum time between polls (in ms), so other commands get a turn */
+#define FCD_MONITOR_GAP_MS 1
+
+/*! \brief Minimum time between polls after a failed poll (in ms) */
+#define FCD_MONITOR_RETRY_MS 100
+
+/*! \brief Time between polls of a monitor started by fcd_agc_start() (in ms) */
+#define FCD_AGC_INTERVAL_MS 20
+
+
+/*
+ * Types
+ */
+
+
+/*! \brief Per-device IF RSSI / PLL lock monitor */
+struct fcd_monitor
+{
+	/*! \brief Device being polled */
+	FCD *dev;
+	/*! \brief Polling thread */
+	pthread_t thread;
+	/*! \brief Protects \p shutdown and \p agc* */
+	pthread_mutex_t lock;
+	/*! \brief Signaled when \p shutdown changes */
+	pthread_cond_t cond;
+	/*! \brief Non-zero once the polling thread should exit */
+	int shutdown;
+	/*! \brief Non-zero while automatic gain control is enabled */
+	int agc;
+	/*! \brief Non-zero if started by fcd_agc_start() */
+	int agc_owner;
+	/*! \brief Lowest IF RSSI left alone by automatic gain control */
+	unsigned char agc_low;
+	/*! \brief Highest IF RSSI left alone by automatic gain control */
+	unsigned char agc_high;
+	/*! \brief Time between polls (in ms) */
+	unsigned int interval_ms;
+	/*! \brief Samples (single producer, single consumer) */
+	fcd_monitor_sample ring[FCD_MONITOR_SLOTS];
+	/*! \brief Count of samples written (by the polling thread only) */
+	unsigned int head;
+	/*! \brief Count of samples read (by fcd_monitor_read() only) */
+	unsigned int tail;
+};
+
+
+/*
+ * Variables
+ */
+
+
+/*! \brief Serializes monitor creation and destruction */
+static pthread_mutex_t monitor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Add a sample to the ring (polling thread only)
+ * \param[in,out] monitor monitor
+ * \param[in,out] sample  sample (\p dropped is set)
+ * \param[in,out] dropped samples dropped since the last one added
+ */
+static void fcd_monitor_push(struct fcd_monitor *monitor,
+	fcd_monitor_sample *sample, unsigned int *dropped)
+{
+	unsigned int head = monitor->head;
+	unsigned int tail = __atomic_load_n(&monitor->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= FCD_MONITOR_SLOTS)
+	{
+		/* full: keep the samples the reader has not seen yet */
+		++*dropped;
+		return;
+	}
+	sample->dropped = *dropped;
+	*dropped = 0;
+	monitor->ring[head & (FCD_MONITOR_SLOTS - 1)] = *sample;
+	__atomic_store_n(&monitor->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*!
+ * \brief IF RSSI / PLL lock polling thread
+ * \param[in,out] param monitor
+ * \returns \c NULL
+ */
+static void * fcd_monitor_thread(void *param)
+{
+	struct fcd_monitor *monitor = param;
+	unsigned int dropped = 0;
+
+	pthread_mutex_lock(&monitor->lock);
+	while (!monitor->shutdown)
+	{
+		fcd_monitor_sample sample;
+		fcd_io_op ops[2];
+		unsigned char rssi = 0, lock = 0;
+		unsigned int wait_ms;
+		int agc = monitor->agc;
+		unsigned char low = monitor->agc_low, high = monitor->agc_high;
+		int result = 0;
+		pthread_mutex_unlock(&monitor->lock);
+
+		/* both commands in flight at once */
+		memset(ops, 0, sizeof(ops));
+		ops[0].cmd = FCD_CMD_GET_IF_RSSI;
+		ops[0].odata = &rssi;
+		ops[0].olen = 1;
+		ops[1].cmd = FCD_CMD_GET_PLL_LOCK;
+		ops[1].odata = &lock;
+		ops[1].olen = 1;
+		sample.status = fcd_io_pipeline(monitor->dev, ops, 2);
+		sample.time = us_now() / 1e6;
+		sample.rssi = rssi;
+		sample.pll_lock = lock & 1;
+		fcd_monitor_push(monitor, &sample, &dropped);
+		if (agc && !sample.status)
+		{
+			fcd_agc_step(monitor->dev, rssi, low, high);
+		}
+
+		wait_ms = monitor->interval_ms;
+		if (wait_ms < FCD_MONITOR_GAP_MS)
+		{
+			/* the handle lock is not fair: leave room for other callers */
+			wait_ms = FCD_MONITOR_GAP_MS;
+		}
+		if (sample.status && wait_ms < FCD_MONITOR_RETRY_MS)
+		{
+			/* do not spin on a missing device */
+			wait_ms = FCD_MONITOR_RETRY_MS;
+		}
+
+		pthread_mutex_lock(&monitor->lock);
+		if (!monitor->shutdown)
+		{
+			struct timespec ts;
+			fcd_cond_deadline(&ts, wait_ms);
+			while (!monitor->shutdown && !result)
+			{
+				result = pthread_cond_timedwait(&monitor->cond,
+					&monitor->lock, &ts);
+			}
+		}
+	}
+	pthread_mutex_unlock(&monitor->lock);
+
+	return NULL;
+}
+
+
+/*!
+ * \brief Start the polling thread of a device
+ * \param[in,out] dev         open \ref FCD (without a monitor)
+ * \param         interval_ms time between polls (in ms)
+ * \retval non-NULL monitor
+ * \retval NULL     error
+ * \pre \p monitor_lock is held
+ */
+static struct fcd_monitor * fcd_monitor_create(FCD *dev,
+	unsigned int interval_ms)
+{
+	struct fcd_monitor *monitor;
+
+	monitor = malloc(sizeof(*monitor));
+	if (NULL == monitor)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	monitor->dev = dev;
+	pthread_mutex_init(&monitor->lock, NULL);
+	fcd_cond_init(&monitor->cond);
+	monitor->shutdown = 0;
+	monitor->agc = 0;
+	monitor->agc_owner = 0;
+	monitor->agc_low = 0;
+	monitor->agc_high = 0;
+	monitor->interval_ms = interval_ms;
+	monitor->head = 0;
+	monitor->tail = 0;
+	if (pthread_create(&monitor->thread, NULL, fcd_monitor_thread, monitor))
+	{
+		pthread_cond_destroy(&monitor->cond);
+		pthread_mutex_destroy(&monitor->lock);
+		free(monitor);
+		errno = ENOMEM;
+		return NULL;
+	}
+	__atomic_store_n(&dev->monitor, monitor, __ATOMIC_RELEASE);
+
+	return monitor;
+}
+
+
+API int fcd_monitor_start(FCD *dev, unsigned int interval_ms)
+{
+	int result = -1;
+
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&monitor_lock);
+	if (NULL != dev->monitor)
+	{
+		errno = EBUSY;
+	}
+	else if (NULL != fcd_monitor_create(dev, interval_ms))
+	{
+		result = 0;
+	}
+	pthread_mutex_unlock(&monitor_lock);
+
+	return result;
+}
+
+
+API void fcd_monitor_stop(FCD *dev)
+{
+	struct fcd_monitor *monitor;
+
+	if (NULL == dev)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&monitor_lock);
+	monitor = dev->monitor;
+	__atomic_store_n(&dev->monitor, NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&monitor_lock);
+
+	if (NULL != monitor)
+	{
+		/* finish the poll in progress, then exit */
+		pthread_mutex_lock(&monitor->lock);
+		monitor->shutdown = 1;
+		pthread_cond_signal(&monitor->cond);
+		pthread_mutex_unlock(&monitor->lock);
+		pthread_join(monitor->thread, NULL);
+
+		pthread_cond_destroy(&monitor->cond);
+		pthread_mutex_destroy(&monitor->lock);
+		free(monitor);
+	}
+}
+
+
+API int fcd_monitor_read(FCD *dev, fcd_monitor_sample *samples,
+	unsigned int count)
+{
+	struct fcd_monitor *monitor;
+	unsigned int head, tail;
+	unsigned int taken = 0;
+
+	if (NULL == dev || (count && NULL == samples))
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	monitor = __atomic_load_n(&dev->monitor, __ATOMIC_ACQUIRE);
+	if (NULL == monitor)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	tail = monitor->tail;
+	head = __atomic_load_n(&monitor->head, __ATOMIC_ACQUIRE);
+	while (taken < count && tail != head)
+	{
+		samples[taken++] = monitor->ring[tail++ & (FCD_MONITOR_SLOTS - 1)];
+	}
+	/* hand the slots back to the polling thread */
+	__atomic_store_n(&monitor->tail, tail, __ATOMIC_RELEASE);
+
+	return (int) taken;
+}
+
+
+API int fcd_agc_start(FCD *dev, unsigned char low, unsigned char high)
+{
+	struct fcd_monitor *monitor;
+	int result = 0;
+
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (low > high)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&monitor_lock);
+	monitor = dev->monitor;
+	if (NULL == monitor)
+	{
+		monitor = fcd_monitor_create(dev, FCD_AGC_INTERVAL_MS);
+		if (NULL != monitor)
+		{
+			monitor->agc_owner = 1;
+		}
+	}
+	if (NULL != monitor)
+	{
+		pthread_mutex_lock(&monitor->lock);
+		monitor->agc = 1;
+		monitor->agc_low = low;
+		monitor->agc_high = high;
+		pthread_mutex_unlock(&monitor->lock);
+	}
+	else
+	{
+		result = -1;
+	}
+	pthread_mutex_unlock(&monitor_lock);
+
+	return result;
+}
+
+
+API void fcd_agc_stop(FCD *dev)
+{
+	struct fcd_monitor *monitor;
+	int owner = 0;
+
+	if (NULL == dev)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&monitor_lock);
+	monitor = dev->monitor;
+	if (NULL != monitor)
+	{
+		pthread_mutex_lock(&monitor->lock);
+		monitor->agc = 0;
+		owner = monitor->agc_owner;
+		pthread_mutex_unlock(&monitor->lock);
+	}
+	pthread_mutex_unlock(&monitor_lock);
+
+	if (owner)
+	{
+		/* nobody else asked for the samples */
+		fcd_monitor_stop(dev);
+	}
+}
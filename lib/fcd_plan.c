@@ -0,0 +1,152 @@
+/*! \file
+ * \brief FUNcube dongle front-end planner implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <limits.h> /* UINT_MAX */
+#include <stdlib.h> /* NULL */
+#include "fcd.h" /* FCD, FCD_BATCH, fcd_front_end */
+#include "fcd_tuner.h" /* FCD_T*E_* */
+#include "fcd_common.h"
+
+
+/*
+ * Types
+ */
+
+
+/*! \brief Front-end settings for a range of frequencies */
+typedef struct
+{
+	/*! \brief Frequency above the range (in Hz, exclusive) */
+	unsigned int upper_Hz;
+	/*! \brief Front-end settings */
+	fcd_front_end plan;
+} fcd_plan_range;
+
+
+/*
+ * Constants
+ */
+
+
+/*!
+ * \brief Front-end settings, by ascending frequency range
+ * \note Band edges follow \ref FCD_TUNER_BAND_ENUM. Within a band, RF
+ * band-pass filter ranges end halfway between neighboring centers.
+ */
+static const fcd_plan_range fcd_plan_ranges[] =
+{
+	{220000000U, {FCD_TBE_VHF2, FCD_TRFE_LPF268MHZ, FCD_TBCE_VUBAND}},
+	{350000000U, {FCD_TBE_VHF3, FCD_TRFE_LPF509MHZ, FCD_TBCE_VUBAND}},
+	{370000000U, {FCD_TBE_UHF, FCD_TRFE_BPF360MHZ, FCD_TBCE_VUBAND}},
+	{392500000U, {FCD_TBE_UHF, FCD_TRFE_BPF380MHZ, FCD_TBCE_VUBAND}},
+	{415000000U, {FCD_TBE_UHF, FCD_TRFE_BPF405MHZ, FCD_TBCE_VUBAND}},
+	{437500000U, {FCD_TBE_UHF, FCD_TRFE_BPF425MHZ, FCD_TBCE_VUBAND}},
+	{462500000U, {FCD_TBE_UHF, FCD_TRFE_BPF450MHZ, FCD_TBCE_VUBAND}},
+	{490000000U, {FCD_TBE_UHF, FCD_TRFE_BPF475MHZ, FCD_TBCE_VUBAND}},
+	{522500000U, {FCD_TBE_UHF, FCD_TRFE_BPF505MHZ, FCD_TBCE_VUBAND}},
+	{557500000U, {FCD_TBE_UHF, FCD_TRFE_BPF540MHZ, FCD_TBCE_VUBAND}},
+	{595000000U, {FCD_TBE_UHF, FCD_TRFE_BPF575MHZ, FCD_TBCE_VUBAND}},
+	{642500000U, {FCD_TBE_UHF, FCD_TRFE_BPF615MHZ, FCD_TBCE_VUBAND}},
+	{695000000U, {FCD_TBE_UHF, FCD_TRFE_BPF670MHZ, FCD_TBCE_VUBAND}},
+	{740000000U, {FCD_TBE_UHF, FCD_TRFE_BPF720MHZ, FCD_TBCE_VUBAND}},
+	{800000000U, {FCD_TBE_UHF, FCD_TRFE_BPF760MHZ, FCD_TBCE_VUBAND}},
+	{865000000U, {FCD_TBE_UHF, FCD_TRFE_BPF840MHZ, FCD_TBCE_VUBAND}},
+	{930000000U, {FCD_TBE_UHF, FCD_TRFE_BPF890MHZ, FCD_TBCE_VUBAND}},
+	{1000000000U, {FCD_TBE_UHF, FCD_TRFE_BPF970MHZ, FCD_TBCE_VUBAND}},
+	{1310000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1300MHZ, FCD_TBCE_LBAND}},
+	{1340000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1320MHZ, FCD_TBCE_LBAND}},
+	{1385000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1360MHZ, FCD_TBCE_LBAND}},
+	{1427500000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1410MHZ, FCD_TBCE_LBAND}},
+	{1452500000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1445MHZ, FCD_TBCE_LBAND}},
+	{1475000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1460MHZ, FCD_TBCE_LBAND}},
+	{1510000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1490MHZ, FCD_TBCE_LBAND}},
+	{1545000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1530MHZ, FCD_TBCE_LBAND}},
+	{1575000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1560MHZ, FCD_TBCE_LBAND}},
+	{1615000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1590MHZ, FCD_TBCE_LBAND}},
+	{1650000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1640MHZ, FCD_TBCE_LBAND}},
+	{1670000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1660MHZ, FCD_TBCE_LBAND}},
+	{1690000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1680MHZ, FCD_TBCE_LBAND}},
+	{1710000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1700MHZ, FCD_TBCE_LBAND}},
+	{1735000000U, {FCD_TBE_LBAND, FCD_TRFE_BPF1720MHZ, FCD_TBCE_LBAND}},
+	{UINT_MAX, {FCD_TBE_LBAND, FCD_TRFE_BPF1750MHZ, FCD_TBCE_LBAND}}
+};
+
+/*! \brief Number of frequency ranges */
+#define FCD_PLAN_RANGES (sizeof(fcd_plan_ranges) / sizeof(fcd_plan_ranges[0]))
+
+
+/*
+ * Functions
+ */
+
+
+API int fcd_plan_front_end(unsigned int freq, fcd_front_end *plan)
+{
+	unsigned int low = 0, high = FCD_PLAN_RANGES - 1;
+
+	if (NULL == plan)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+
+	/* first range that ends above freq (the last one never ends) */
+	while (low < high)
+	{
+		unsigned int mid = low + (high - low) / 2;
+		if (freq < fcd_plan_ranges[mid].upper_Hz)
+		{
+			high = mid;
+		}
+		else
+		{
+			low = mid + 1;
+		}
+	}
+
+	*plan = fcd_plan_ranges[low].plan;
+	return 0;
+}
+
+
+API int fcd_set_frequency_Hz_planned(FCD *dev, unsigned int freq)
+{
+	FCD_BATCH *batch;
+	int result = -1;
+
+	batch = fcd_batch_new();
+	if (NULL == batch)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	if (fcd_batch_set_frequency_Hz_planned(batch, freq) >= 0)
+	{
+		result = fcd_batch_run(dev, batch, NULL);
+	}
+	fcd_batch_free(batch);
+
+	return result;
+}
@@ -0,0 +1,178 @@
+/*! \file
+ * \brief FUNcube dongle device registry implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <pthread.h> /* pthread_mutex_* */
+#include <stdlib.h> /* NULL, malloc, free */
+#include <string.h> /* memcpy, strlen */
+#include "fcd.h" /* FCD_USB_VID, FCD_USB_PID */
+#include "fcd_common.h"
+
+
+/*
+ * Variables
+ */
+
+
+/*! \brief Process-wide registry of attached FUNcube dongles */
+static struct
+{
+	/*! \brief Protects all other members */
+	pthread_mutex_t lock;
+	/*! \brief Non-zero if \p paths reflects \p generation */
+	int valid;
+	/*! \brief Hotplug generation of \p paths */
+	int generation;
+	/*! \brief Cached path list (see fcd_registry_snapshot()) */
+	char **paths;
+	/*! \brief Size of \p paths allocation (in bytes) */
+	size_t size;
+} registry = {PTHREAD_MUTEX_INITIALIZER, 0, -1, NULL, 0};
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Pack a device enumeration into a single allocation
+ * \param[in]  devs enumerated devices
+ * \param[out] size size of allocation (in bytes)
+ * \retval non-NULL \c NULL-terminated path list (must be freed)
+ * \retval NULL     error
+ */
+static char ** registry_pack(const struct hid_device_info *devs, size_t *size)
+{
+	const struct hid_device_info *current;
+	unsigned int count = 0;
+	size_t total;
+	char **paths;
+	char *str;
+
+	/* size pointer table and strings */
+	total = sizeof(char *);
+	for (current = devs; NULL != current; current = current->next)
+	{
+		if (NULL != current->path)
+		{
+			total += sizeof(char *) + strlen(current->path) + 1;
+			++count;
+		}
+	}
+
+	paths = malloc(total);
+	if (NULL == paths)
+	{
+		return NULL;
+	}
+
+	/* strings follow the pointer table */
+	str = (char *) (paths + count + 1);
+	count = 0;
+	for (current = devs; NULL != current; current = current->next)
+	{
+		if (NULL != current->path)
+		{
+			size_t len = strlen(current->path) + 1;
+			memcpy(str, current->path, len);
+			paths[count++] = str;
+			str += len;
+		}
+	}
+	paths[count] = NULL;
+
+	*size = total;
+	return paths;
+}
+
+
+/*!
+ * \brief Bring the registry up to date
+ * \pre \p registry.lock is held
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int registry_refresh(void)
+{
+	struct hid_device_info *devs;
+	char **paths;
+	size_t size;
+	int generation;
+
+	generation = hid_hotplug_generation();
+	if (registry.valid && generation >= 0 &&
+		generation == registry.generation)
+	{
+		/* nothing has been attached or detached */
+		return 0;
+	}
+
+	/* (re-)enumerate FUNcube dongles */
+	devs = hid_enumerate(FCD_USB_VID, FCD_USB_PID);
+	paths = registry_pack(devs, &size);
+	hid_free_enumeration(devs);
+	if (NULL == paths)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	free(registry.paths);
+	registry.paths = paths;
+	registry.size = size;
+	registry.generation = generation;
+	registry.valid = 1;
+	return 0;
+}
+
+
+char ** fcd_registry_snapshot(void)
+{
+	char **paths = NULL;
+
+	pthread_mutex_lock(&registry.lock);
+	if (!registry_refresh())
+	{
+		paths = malloc(registry.size);
+		if (NULL != paths)
+		{
+			unsigned int index;
+			/* copy, then rebase string pointers onto the copy */
+			memcpy(paths, registry.paths, registry.size);
+			for (index = 0; NULL != paths[index]; ++index)
+			{
+				paths[index] = (char *) paths +
+					(registry.paths[index] - (char *) registry.paths);
+			}
+		}
+		else
+		{
+			errno = ENOMEM;
+		}
+	}
+	pthread_mutex_unlock(&registry.lock);
+
+	return paths;
+}
@@ -0,0 +1,177 @@
+/*! \file
+ * \brief FUNcube dongle lock-aware retune implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <stdlib.h> /* NULL */
+#include <string.h> /* memset */
+#include "fcd.h" /* FCD, fcd_retune */
+#include "fcd_cmd.h" /* FCD_CMD_* */
+#include "fcd_common.h"
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Add a settle time to statistics
+ * \param[in,out] stats     statistics
+ * \param         settle_us settle time (in us)
+ */
+static void fcd_retune_record(fcd_settle_stats *stats, unsigned int settle_us)
+{
+	++stats->count;
+	if (1 == stats->count || settle_us < stats->min_us)
+	{
+		stats->min_us = settle_us;
+	}
+	if (settle_us > stats->max_us)
+	{
+		stats->max_us = settle_us;
+	}
+	/* running mean */
+	stats->mean_us = (unsigned int) ((int64_t) stats->mean_us +
+		((int64_t) settle_us - stats->mean_us) / stats->count);
+}
+
+
+API int fcd_retune(FCD *dev, unsigned int freq, int timeout_ms,
+	unsigned int *settle_us)
+{
+	fcd_settle_stats *stats = NULL;
+	fcd_io_op ops[2];
+	uint32_t fHz;
+	unsigned char band = 0, lock = 0;
+	int64_t deadline, tuned, now;
+	int pinned, result;
+
+	if (NULL == dev)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	deadline = (timeout_ms < 0) ? -1 : ms_now() + timeout_ms;
+
+	/* nothing else may retune between the set and the lock */
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	pinned = fcd_pin(dev);
+	if (pinned < 0)
+	{
+		fcd_unlock(dev);
+		return -1;
+	}
+
+	/* set frequency and learn the band the device picked in one round trip */
+	fHz = convert_le_u32(freq);
+	memset(ops, 0, sizeof(ops));
+	ops[0].cmd = FCD_CMD_SET_FREQUENCY_HZ;
+	ops[0].idata = &fHz;
+	ops[0].ilen = sizeof(fHz);
+	ops[1].cmd = FCD_CMD_GET_VALUE_OFFSET + FCD_VALUE_BAND;
+	ops[1].odata = &band;
+	ops[1].olen = 1;
+	result = fcd_io_pipeline_until(dev, ops, 2, deadline);
+	tuned = now = us_now();
+
+	if (!result)
+	{
+		if (band < FCD_SETTLE_BANDS)
+		{
+			stats = &dev->settle[band];
+		}
+		if (ops[0].cached)
+		{
+			/* already on this frequency: nothing was sent, so nothing to
+			   settle (and no settle time worth recording) */
+			stats = NULL;
+		}
+		if (NULL != stats && stats->count)
+		{
+			/* the first poll should arrive just as the earliest lock seen
+			   (settle times are measured from tuned) */
+			int64_t wait_us = stats->min_us - (us_now() - tuned);
+			if (wait_us >= 1000)
+			{
+				ms_sleep((unsigned int) (wait_us / 1000));
+			}
+		}
+		for (;;)
+		{
+			result = fcd_io_until(dev, FCD_CMD_GET_PLL_LOCK, 0, NULL, 0, &lock,
+				1, deadline);
+			now = us_now();
+			if (result || (lock & 1))
+			{
+				break;
+			}
+			if (deadline >= 0 && ms_now() >= deadline)
+			{
+				errno = ETIMEDOUT;
+				result = -1;
+				break;
+			}
+		}
+	}
+
+	if (!result && NULL != stats)
+	{
+		fcd_retune_record(stats, (unsigned int) (now - tuned));
+	}
+	if (NULL != settle_us)
+	{
+		*settle_us = (!result && ops[0].cached) ? 0 :
+			(unsigned int) (now - tuned);
+	}
+
+	fcd_unpin(dev, pinned);
+	fcd_unlock(dev);
+	return result;
+}
+
+
+API int fcd_get_settle_stats(FCD *dev, unsigned int band,
+	fcd_settle_stats *stats)
+{
+	if (NULL == dev || NULL == stats)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (band >= FCD_SETTLE_BANDS)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	*stats = dev->settle[band];
+	fcd_unlock(dev);
+	return 0;
+}
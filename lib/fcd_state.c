@@ -0,0 +1,216 @@
+/*! \file
+ * \brief FUNcube dongle tuner state snapshot/restore implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <stdlib.h> /* NULL */
+#include "fcd.h" /* FCD, FCD_BATCH, fcd_state */
+#include "fcd_common.h"
+
+
+/*
+ * Constants
+ */
+
+
+/*!
+ * \brief Order in which fcd_set_state() applies 1-byte values
+ * \note Band and RF filter come first (right after frequency), bias tee last.
+ */
+static const FCD_VALUE_ENUM fcd_state_order[FCD_VALUE_UNDEFINED] =
+{
+	/* front-end selection */
+	FCD_VALUE_BAND,
+	FCD_VALUE_RF_FILTER,
+	/* filters and modes */
+	FCD_VALUE_MIXER_FILTER,
+	FCD_VALUE_IF_RC_FILTER,
+	FCD_VALUE_IF_FILTER,
+	FCD_VALUE_IF_GAIN_MODE,
+	FCD_VALUE_LNA_ENHANCE,
+	FCD_VALUE_BIAS_CURRENT,
+	/* gains */
+	FCD_VALUE_LNA_GAIN,
+	FCD_VALUE_MIXER_GAIN,
+	FCD_VALUE_IF_GAIN1,
+	FCD_VALUE_IF_GAIN2,
+	FCD_VALUE_IF_GAIN3,
+	FCD_VALUE_IF_GAIN4,
+	FCD_VALUE_IF_GAIN5,
+	FCD_VALUE_IF_GAIN6,
+	/* external power */
+	FCD_VALUE_BIAS_TEE
+};
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Read complete tuner state
+ * \param[in,out] dev   open \ref FCD
+ * \param[in,out] batch empty \ref FCD_BATCH to use
+ * \param[out]    state tuner state
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int fcd_state_read(FCD *dev, FCD_BATCH *batch, fcd_state *state)
+{
+	fcd_batch_result results[FCD_VALUE_UNDEFINED + 3];
+	unsigned int index;
+	int freq, dc, iq;
+
+	for (index = 0; index < FCD_VALUE_UNDEFINED; ++index)
+	{
+		if (fcd_batch_get_value(batch, (FCD_VALUE_ENUM) index) < 0)
+		{
+			return -1;
+		}
+	}
+	freq = fcd_batch_get_frequency_Hz(batch);
+	dc = fcd_batch_get_dc_correction(batch);
+	iq = fcd_batch_get_iq_correction(batch);
+	if (freq < 0 || dc < 0 || iq < 0)
+	{
+		return -1;
+	}
+
+	/* known settings are answered from the shadow of tuner state */
+	if (fcd_batch_run(dev, batch, results))
+	{
+		return -1;
+	}
+
+	for (index = 0; index < FCD_VALUE_UNDEFINED; ++index)
+	{
+		state->value[index] = (unsigned char) results[index].value;
+	}
+	state->frequency_Hz = (unsigned int) results[freq].value;
+	state->dc_i = (int) results[dc].value;
+	state->dc_q = (int) results[dc].value2;
+	state->iq_phase = (int) results[iq].value;
+	state->iq_gain = (unsigned int) results[iq].value2;
+	return 0;
+}
+
+
+API int fcd_get_state(FCD *dev, fcd_state *state)
+{
+	FCD_BATCH *batch;
+	int result;
+
+	if (NULL == dev || NULL == state)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+
+	batch = fcd_batch_new();
+	if (NULL == batch)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	result = fcd_state_read(dev, batch, state);
+	fcd_batch_free(batch);
+
+	return result;
+}
+
+
+API int fcd_set_state(FCD *dev, const fcd_state *state)
+{
+	fcd_state current;
+	FCD_BATCH *batch;
+	unsigned int index;
+	int freq_changed;
+	int result = -1;
+
+	if (NULL == dev || NULL == state)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+
+	batch = fcd_batch_new();
+	if (NULL == batch)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* diff and apply as one transaction */
+	if (fcd_lock(dev))
+	{
+		fcd_batch_free(batch);
+		return -1;
+	}
+	if (fcd_state_read(dev, batch, &current))
+	{
+		goto done;
+	}
+	fcd_batch_clear(batch);
+
+	/* frequency first: the device then picks band and RF filter */
+	freq_changed = (state->frequency_Hz != current.frequency_Hz);
+	if (freq_changed &&
+		fcd_batch_set_frequency_Hz(batch, state->frequency_Hz) < 0)
+	{
+		goto done;
+	}
+	for (index = 0; index < FCD_VALUE_UNDEFINED; ++index)
+	{
+		FCD_VALUE_ENUM id = fcd_state_order[index];
+		int changed = (state->value[id] != current.value[id]);
+		if (freq_changed &&
+			(FCD_VALUE_BAND == id || FCD_VALUE_RF_FILTER == id))
+		{
+			/* overridden by the frequency change */
+			changed = 1;
+		}
+		if (changed && fcd_batch_set_value(batch, id, state->value[id]) < 0)
+		{
+			goto done;
+		}
+	}
+	if ((state->dc_i != current.dc_i || state->dc_q != current.dc_q) &&
+		fcd_batch_set_dc_correction(batch, state->dc_i, state->dc_q) < 0)
+	{
+		goto done;
+	}
+	if ((state->iq_phase != current.iq_phase ||
+		state->iq_gain != current.iq_gain) &&
+		fcd_batch_set_iq_correction(batch, state->iq_phase, state->iq_gain) < 0)
+	{
+		goto done;
+	}
+
+	result = fcd_batch_run(dev, batch, NULL);
+
+done:
+	fcd_unlock(dev);
+	fcd_batch_free(batch);
+	return result;
+}
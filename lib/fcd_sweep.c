@@ -0,0 +1,121 @@
+/*! \file
+ * \brief FUNcube dongle frequency sweep implementation
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h> /* E*, errno */
+#include <stdlib.h> /* NULL */
+#include "fcd.h" /* FCD, fcd_sweep */
+#include "fcd_cmd.h" /* FCD_CMD_* */
+#include "fcd_common.h"
+
+
+/*
+ * Functions
+ */
+
+
+API int fcd_sweep(FCD *dev, unsigned int start_Hz, unsigned int stop_Hz,
+	unsigned int step_Hz, unsigned int dwell_ms, fcd_sweep_callback *fn,
+	void *context)
+{
+	fcd_sweep_step step;
+	unsigned int range, offset;
+	uint32_t fHz, actual;
+	int64_t next = -1;
+	double start;
+	int pinned;
+	int result = 0;
+
+	if (NULL == dev || NULL == fn)
+	{
+		errno = EFAULT;
+		return -1;
+	}
+	if (!step_Hz)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	range = (start_Hz <= stop_Hz) ? stop_Hz - start_Hz : start_Hz - stop_Hz;
+
+	/* one transaction on one open device: no per-step lock or reopen */
+	if (fcd_lock(dev))
+	{
+		return -1;
+	}
+	pinned = fcd_pin(dev);
+	if (pinned < 0)
+	{
+		fcd_unlock(dev);
+		return -1;
+	}
+
+	start = us_now() / 1e6;
+	for (step.index = 0, offset = 0; ; ++step.index, offset += step_Hz)
+	{
+		step.frequency_Hz = (start_Hz <= stop_Hz) ?
+			start_Hz + offset : start_Hz - offset;
+
+		if (next >= 0)
+		{
+			/* hold the previous frequency for the rest of its dwell time */
+			int64_t wait = next - ms_now();
+			if (wait > 0)
+			{
+				ms_sleep((unsigned int) wait);
+			}
+		}
+
+		/* the response to a frequency set carries the frequency tuned to */
+		fHz = convert_le_u32(step.frequency_Hz);
+		result = fcd_io(dev, FCD_CMD_SET_FREQUENCY_HZ, 0, &fHz, sizeof(fHz),
+			&actual, sizeof(actual));
+		if (result)
+		{
+			break;
+		}
+		step.time = us_now() / 1e6;
+		if (dwell_ms)
+		{
+			next = ms_now() + dwell_ms;
+		}
+		step.actual_Hz = convert_le_u32(actual);
+		step.rate = (step.time > start) ?
+			((double) step.index + 1) / (step.time - start) : 0;
+
+		if (fn(dev, &step, context))
+		{
+			break;
+		}
+		/* stop at the last step before passing stop_Hz (offset is kept
+		   within range, so it can not wrap) */
+		if (range - offset < step_Hz)
+		{
+			break;
+		}
+	}
+
+	fcd_unpin(dev, pinned);
+	fcd_unlock(dev);
+	return result;
+}
@@ -0,0 +1,156 @@
+/*! \file
+ * \brief FUNcube dongle transport benchmark
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> /* printf, fprintf, stderr */
+#include <stdlib.h> /* EXIT_SUCCESS, EXIT_FAILURE, NULL, strtoul */
+#include "fcd.h" /* FCD, fcd_* */
+#include "common.h" /* now */
+
+
+/*! \brief Default number of commands per measurement */
+#define DEFAULT_COUNT 1000
+
+
+/*!
+ * \brief Report a measurement
+ * \param name    measurement name
+ * \param count   number of commands
+ * \param elapsed elapsed time (in seconds)
+ */
+static void report(const char *name, unsigned int count, double elapsed)
+{
+	printf("%-24s %8.0f cmd/s %8.1f us/cmd\n", name, count / elapsed,
+		1e6 * elapsed / count);
+}
+
+
+/*!
+ * \brief Benchmark one transport mode
+ * \param path  device path (or \c NULL)
+ * \param flags open flags
+ * \param name  transport mode name
+ * \param count number of commands per measurement
+ * \retval 0     success
+ * \retval non-0 failure
+ */
+static int bench(const char *path, unsigned int flags, const char *name,
+	unsigned int count)
+{
+	FCD *fcd;
+	FCD_BATCH *batch;
+	unsigned int index, freq;
+	double start;
+	char label[64];
+	int result = 0;
+
+	/* time round trips, not answers from the shadow of tuner state */
+	fcd = fcd_open_flags(path, flags | FCD_OPEN_NO_CACHE);
+	if (NULL == fcd)
+	{
+		fprintf(stderr, "Could not open device\n");
+		return -1;
+	}
+
+	/* one command per round trip */
+	start = now();
+	for (index = 0; index < count && !result; ++index)
+	{
+		result = fcd_get_frequency_Hz(fcd, &freq);
+	}
+	snprintf(label, sizeof(label), "%s sequential", name);
+	if (!result)
+	{
+		report(label, count, now() - start);
+	}
+
+	/* the same commands as one batch */
+	batch = fcd_batch_new();
+	for (index = 0; index < count && NULL != batch; ++index)
+	{
+		if (fcd_batch_get_frequency_Hz(batch) < 0)
+		{
+			fcd_batch_free(batch);
+			batch = NULL;
+		}
+	}
+	if (!result && NULL != batch)
+	{
+		start = now();
+		result = fcd_batch_run(fcd, batch, NULL);
+		snprintf(label, sizeof(label), "%s batch", name);
+		if (!result)
+		{
+			report(label, count, now() - start);
+		}
+	}
+	fcd_batch_free(batch);
+
+	if (result)
+	{
+		fprintf(stderr, "%s: command failed\n", name);
+	}
+
+	fcd_close(fcd);
+	return result;
+}
+
+
+/*!
+ * \brief Main entry point
+ * \param argc number of command line arguments
+ * \param argv command line arguments
+ * \retval EXIT_SUCCESS success
+ * \retval EXIT_FAILURE failure
+ */
+int main(int argc, char **argv)
+{
+	unsigned int count = DEFAULT_COUNT;
+	const char *path = NULL;
+	int result = 0;
+
+	if (argc > 3)
+	{
+		fprintf(stderr, "Usage: %s [COUNT [PATH]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc > 1)
+	{
+		char *end;
+		count = strtoul(argv[1], &end, 0);
+		if (!count || *end)
+		{
+			fprintf(stderr, "invalid count: %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc > 2)
+	{
+		path = argv[2];
+	}
+
+	result |= bench(path, FCD_OPEN_DEFAULT, "threaded", count);
+	result |= bench(path, FCD_OPEN_DIRECT, "direct", count);
+
+	return result ? EXIT_FAILURE : EXIT_SUCCESS;
+}
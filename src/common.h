@@ -0,0 +1,46 @@
+/*! \file
+ * \brief FUNcube dongle tool common interface definition
+ * \author Justin R. Cutler
+ */
+/*
+ * Copyright (C) 2012 Justin R. Cutler
+ *
+ * libfcd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libfcd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libfcd.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FCD_TOOL_COMMON_H
+# define FCD_TOOL_COMMON_H
+
+# ifdef __cplusplus
+extern "C"
+{
+# endif
+
+
+/*
+ * Functions
+ */
+
+
+/*!
+ * \brief Get monotonic time
+ * \returns time (in seconds)
+ */
+double now(void);
+
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* FCD_TOOL_COMMON_H */
@@ -23,12 +23,15 @@
 #endif
 
 #include <stdio.h> /* fprintf, stderr, perror, fopen, fclose, fseek, ftell, SEEK_END, SEEK_SET */
-#include <stdlib.h> /* EXIT_SUCCESS, EXIT_FAILURE, NULL */
+#include <stdlib.h> /* EXIT_SUCCESS, EXIT_FAILURE, NULL, realloc, free */
+#include <string.h> /* strdup */
 #ifdef HAVE_GETOPT_H
 # include <getopt.h> /* getopt_long */
 #endif
 #include <limits.h> /* CHAR_MAX */
+#include <pthread.h> /* pthread_* */
 #include "fcd.h" /* FCD, fcd_* */
+#include "common.h" /* now */
 
 
 /*
@@ -44,7 +47,13 @@ enum
 	/*! \brief Display version and exit */
 	OPTION_VERSION,
 	/*! \brief Perform full flash update */
-	OPTION_FLASH
+	OPTION_FLASH,
+	/*! \brief Write one block at a time */
+	OPTION_NO_PIPELINE,
+	/*! \brief Number of devices to flash at once */
+	OPTION_JOBS,
+	/*! \brief Skip devices that already hold the image */
+	OPTION_IF_CHANGED
 };
 
 /*! \brief Action flags */
@@ -77,8 +86,33 @@ typedef struct
 	unsigned char *data;
 	/*! \brief Flash data size */
 	unsigned long int size;
+	/*! \brief Write one block at a time (as before pipelined writes) */
+	int no_pipeline;
+	/*! \brief Number of devices to flash at once (0 for one by one) */
+	unsigned int jobs;
+	/*! \brief Skip devices whose flash already matches the image */
+	int if_changed;
 } flash_context;
 
+/*! \brief Devices to flash with a pool of workers (see --jobs) */
+typedef struct
+{
+	/*! \brief Flash context */
+	flash_context *ctx;
+	/*! \brief Device paths */
+	char **paths;
+	/*! \brief Number of device paths */
+	unsigned int count;
+	/*! \brief Protects \p next, \p done, and \p failed */
+	pthread_mutex_t lock;
+	/*! \brief Index of the next device to flash */
+	unsigned int next;
+	/*! \brief Number of devices finished */
+	unsigned int done;
+	/*! \brief Number of devices that failed */
+	unsigned int failed;
+} flash_pool;
+
 
 /*
  * Variables
@@ -99,6 +133,9 @@ static const struct option long_options[] =
 	{"no-write",  no_argument,       NULL, 'W'},
 	{"verify",    no_argument,       NULL, 'v'},
 	{"no-verify", no_argument,       NULL, 'V'},
+	{"no-pipeline", no_argument,     NULL, OPTION_NO_PIPELINE},
+	{"jobs",      required_argument, NULL, OPTION_JOBS},
+	{"if-changed", no_argument,      NULL, OPTION_IF_CHANGED},
 	{"help",      no_argument,       NULL, OPTION_HELP},
 	{"version",   no_argument,       NULL, OPTION_VERSION},
 	/* meta-actions */
@@ -191,6 +228,106 @@ static void *fread_all(FILE *stream, unsigned long *len)
 }
 
 
+/*!
+ * \brief Print a progress line for a device
+ * \param[in] path  device path
+ * \param[in] phase what the device is doing
+ */
+static void progress(const char *path, const char *phase)
+{
+	printf("[%s] %s\n", path, phase);
+	/* show each phase as it starts, even when output is piped */
+	fflush(stdout);
+}
+
+
+/*!
+ * \brief Write flash and report the write rate
+ * \param[in,out] fcd     open \ref FCD
+ * \param[in]     path    device path
+ * \param[in]     ctx     flash context
+ * \param[in,out] actions remaining actions (\ref ACTION_VERIFY is cleared if
+ *                        the write verified the flash too)
+ * \retval 0     success
+ * \retval non-0 failure (as fcd_bl_flash_write())
+ */
+static int flash_write(FCD *fcd, const char *path, const flash_context *ctx,
+	unsigned int *actions)
+{
+	unsigned int start, end, rewrites;
+	double rate = 0, begin;
+	int result;
+
+	if (!ctx->no_pipeline && (*actions & ACTION_VERIFY))
+	{
+		/* read each window back right after writing it */
+		begin = now();
+		result = fcd_bl_flash_write_verified(fcd, ctx->data, ctx->size,
+			&rewrites);
+		if (!result && !fcd_bl_get_address_range(fcd, &start, &end))
+		{
+			rate = (end - start) / 48 / (now() - begin);
+			printf("[%s] write+verify: %.0f blocks/s, %u window(s) "
+				"rewritten\n", path, rate, rewrites);
+		}
+		*actions &= ~ACTION_VERIFY;
+		return result;
+	}
+	if (ctx->no_pipeline)
+	{
+		/* time the whole call, including the address setup */
+		begin = now();
+		result = fcd_bl_flash_write(fcd, ctx->data, ctx->size);
+		if (!result && !fcd_bl_get_address_range(fcd, &start, &end))
+		{
+			rate = (end - start) / 48 / (now() - begin);
+		}
+	}
+	else
+	{
+		result = fcd_bl_flash_write_pipelined(fcd, ctx->data, ctx->size,
+			&rate);
+	}
+	if (!result)
+	{
+		printf("[%s] write: %.0f blocks/s\n", path, rate);
+	}
+	return result;
+}
+
+
+/*!
+ * \brief Print the blocks that differ in a verify report
+ * \param[in] path   device path
+ * \param[in] report verify report
+ */
+static void print_mismatches(const char *path, const fcd_verify_report *report)
+{
+	unsigned int block = 0, first;
+
+	fprintf(stderr, "[%s] verify: %u of %u blocks differ "
+		"(flash crc %08x, image crc %08x)\n", path, report->mismatches,
+		report->blocks, report->flash_crc, report->image_crc);
+	while (block < report->blocks)
+	{
+		if (!FCD_VERIFY_BLOCK_DIFFERS(report, block))
+		{
+			++block;
+			continue;
+		}
+		/* one line per run of differing blocks */
+		first = block;
+		while (block < report->blocks &&
+			FCD_VERIFY_BLOCK_DIFFERS(report, block))
+		{
+			++block;
+		}
+		fprintf(stderr, "[%s]   0x%04x-0x%04x\n", path,
+			report->start + 48 * first, report->start + 48 * block - 1);
+	}
+}
+
+
 /*! \brief Look up an error message by \p result
  * \param result previous operation's result
  * \returns String containing error message
@@ -227,29 +364,62 @@ static int funcube_flash(const char *path, void *context)
 
 	if (NULL != fcd)
 	{
-		if (ctx->actions & ACTION_ERASE)
+		unsigned int actions = ctx->actions;
+		if (ctx->if_changed && NULL != ctx->data &&
+			(actions & (ACTION_ERASE|ACTION_WRITE)))
+		{
+			/* compare flash with the image before touching anything */
+			progress(path, "comparing...");
+			result = fcd_bl_flash_is_current(fcd, ctx->data, ctx->size);
+			if (result > 0)
+			{
+				/* the check read back the whole flash already */
+				printf("[%s] up to date\n", path);
+				actions &= ~(ACTION_ERASE|ACTION_WRITE|ACTION_VERIFY);
+				result = 0;
+			}
+			else if (result < 0)
+			{
+				fprintf(stderr, "[%s] digest: %s\n", path, error_msg(result));
+			}
+		}
+		if (!result && actions & ACTION_ERASE)
 		{
 			/* erase flash */
+			progress(path, "erasing...");
 			result = fcd_bl_erase_application(fcd);
 			if (result)
 			{
 				fprintf(stderr, "[%s] erase failed\n", path);
 			}
 		}
-		if (!result && ctx->actions & ACTION_WRITE)
+		if (!result && actions & ACTION_WRITE)
 		{
 			/* flash device */
-			result = fcd_bl_flash_write(fcd, ctx->data, ctx->size);
+			progress(path, (actions & ACTION_VERIFY) && !ctx->no_pipeline ?
+				"writing and verifying..." : "writing...");
+			result = flash_write(fcd, path, ctx, &actions);
 			if (result)
 			{
 				fprintf(stderr, "[%s] write: %s\n", path, error_msg(result));
 			}
 		}
-		if (!result && ctx->actions & ACTION_VERIFY)
+		if (!result && actions & ACTION_VERIFY)
 		{
-			/* verify flash */
-			result = fcd_bl_flash_verify(fcd, ctx->data, ctx->size);
-			if (result)
+			/* verify flash, finding every difference */
+			fcd_verify_report report;
+			progress(path, "verifying...");
+			result = fcd_bl_flash_verify_report(fcd, ctx->data, ctx->size,
+				&report);
+			if (!result)
+			{
+				progress(path, "verify: ok");
+			}
+			else if (result > 0)
+			{
+				print_mismatches(path, &report);
+			}
+			else if (result)
 			{
 				fprintf(stderr, "[%s] verify: %s\n", path, error_msg(result));
 			}
@@ -257,6 +427,7 @@ static int funcube_flash(const char *path, void *context)
 	}
 	else
 	{
+		fprintf(stderr, "[%s] open failed\n", path);
 		result = -1;
 	}
 
@@ -266,6 +437,149 @@ static int funcube_flash(const char *path, void *context)
 }
 
 
+/*! \copydetails fcd_path_callback
+ * \brief Add a device to a \ref flash_pool
+ */
+static int collect_path(const char *path, void *context)
+{
+	flash_pool *pool = context;
+	char **paths;
+
+	paths = realloc(pool->paths, (pool->count + 1) * sizeof(*paths));
+	if (NULL == paths)
+	{
+		return -1;
+	}
+	pool->paths = paths;
+	paths[pool->count] = strdup(path);
+	if (NULL == paths[pool->count])
+	{
+		return -1;
+	}
+	++pool->count;
+	return 0;
+}
+
+
+/*!
+ * \brief Flash devices from a \ref flash_pool until none are left
+ * \param[in,out] param pool
+ * \returns \c NULL
+ */
+static void *flash_worker(void *param)
+{
+	flash_pool *pool = param;
+
+	for (;;)
+	{
+		unsigned int index, done;
+		double start, elapsed;
+		int result;
+
+		pthread_mutex_lock(&pool->lock);
+		index = pool->next;
+		if (index < pool->count)
+		{
+			++pool->next;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		if (index >= pool->count)
+		{
+			break;
+		}
+
+		/* a failure only affects this device */
+		start = now();
+		result = funcube_flash(pool->paths[index], pool->ctx);
+		elapsed = now() - start;
+
+		pthread_mutex_lock(&pool->lock);
+		done = ++pool->done;
+		if (result)
+		{
+			++pool->failed;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		printf("[%s] %s in %.1f s (%u/%u)\n", pool->paths[index],
+			result ? "failed" : "done", elapsed, done, pool->count);
+	}
+
+	return NULL;
+}
+
+
+/*!
+ * \brief Erase/flash/verify all devices present, several at a time
+ * \param[in,out] ctx flash context (\p jobs is non-zero)
+ * \retval 0     success
+ * \retval non-0 failure (of at least one device)
+ */
+static int flash_all(flash_context *ctx)
+{
+	flash_pool pool;
+	pthread_t *threads;
+	unsigned int index, started;
+	double start;
+	int result = 0;
+
+	pool.ctx = ctx;
+	pool.paths = NULL;
+	pool.count = 0;
+
+	/* take the device list first: flashing does not change it */
+	if (fcd_for_each(collect_path, &pool))
+	{
+		fputs("device lookup failed\n", stderr);
+		result = -1;
+	}
+	threads = malloc(ctx->jobs * sizeof(*threads));
+	if (!result && NULL == threads)
+	{
+		perror("malloc");
+		result = -1;
+	}
+
+	if (!result)
+	{
+		pthread_mutex_init(&pool.lock, NULL);
+		pool.next = pool.done = pool.failed = 0;
+		start = now();
+		for (started = 0; started < ctx->jobs && started < pool.count;
+			++started)
+		{
+			if (pthread_create(&threads[started], NULL, flash_worker, &pool))
+			{
+				/* carry on with the workers already running */
+				break;
+			}
+		}
+		if (!started)
+		{
+			/* no workers at all: flash from this thread */
+			flash_worker(&pool);
+		}
+		for (index = 0; index < started; ++index)
+		{
+			pthread_join(threads[index], NULL);
+		}
+		pthread_mutex_destroy(&pool.lock);
+
+		printf("%u device(s): %u done, %u failed in %.1f s\n", pool.count,
+			pool.count - pool.failed, pool.failed, now() - start);
+		result = pool.failed ? -1 : 0;
+	}
+
+	free(threads);
+	for (index = 0; index < pool.count; ++index)
+	{
+		free(pool.paths[index]);
+	}
+	free(pool.paths);
+
+	return result;
+}
+
+
 /*! \brief Print an error and exit */
 static void die(void)
 {
@@ -304,6 +618,12 @@ static void usage(void)
 	puts("  -W, --no-write    do not write to flash");
 	puts("  -v, --verify      verify flash against image");
 	puts("  -V, --no-verify   do not verify flash");
+	puts("      --no-pipeline write one block at a time, and verify separately");
+	puts("                    (to compare write rates)");
+	puts("      --jobs=N      flash up to N devices at once; carry on past a");
+	puts("                    device that fails");
+	puts("      --if-changed  skip erase, write, and verify on devices whose");
+	puts("                    flash already matches the image");
 	puts("      --help        display this help and exit");
 	puts("      --version     output version information and exit");
 	puts("");
@@ -312,6 +632,8 @@ static void usage(void)
 	puts("  Write `export18b.bin` to FUNcube dongle");
 	puts("fcd-flash --flash=export18b.bin --no-erase --no-write");
 	puts("  Reset and verify flash matches `export18b.bin`");
+	puts("fcd-flash --flash=export18b.bin --if-changed --jobs=4");
+	puts("  Upgrade every FUNcube dongle not yet running `export18b.bin`");
 	puts("fcd-flash -r1000 -vi export18b.bin");
 	puts("  Reset with 1 second delay and verify flash matches `export18b.bin`");
 
@@ -331,7 +653,7 @@ int main(int argc, char **argv)
 	int result = EXIT_SUCCESS;
 	int c, index;
 	char *filename = NULL;
-	flash_context context = {0, 2000, NULL, 0};
+	flash_context context = {0, 2000, NULL, 0, 0, 0, 0};
 
 	/* parse command line */
 	while ((c = getopt_long(argc, argv, "i:r::ReEwWvV", long_options, &index)) != -1)
@@ -381,6 +703,26 @@ int main(int argc, char **argv)
 				filename = optarg;
 				break;
 
+			case OPTION_NO_PIPELINE:
+				context.no_pipeline = 1;
+				break;
+
+			case OPTION_JOBS:
+				{
+					char *end;
+					context.jobs = strtoul(optarg, &end, 0);
+					if (end == optarg || *end || !context.jobs)
+					{
+						fprintf(stderr, "Invalid job count\n");
+						die();
+					}
+				}
+				break;
+
+			case OPTION_IF_CHANGED:
+				context.if_changed = 1;
+				break;
+
 			case OPTION_HELP:
 				usage();
 				break;
@@ -442,7 +784,14 @@ int main(int argc, char **argv)
 	}
 
 	/* erase/flash/verify all FUNcube dongles present */
-	if (fcd_for_each(funcube_flash, &context))
+	if (context.jobs)
+	{
+		if (flash_all(&context))
+		{
+			result = EXIT_FAILURE;
+		}
+	}
+	else if (fcd_for_each(funcube_flash, &context))
 	{
 		result = EXIT_FAILURE;
 	}